@@ -2,10 +2,14 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct kmem_cache;
+struct vma;
+struct seg;
 struct pipe;
 struct proc;
 struct spinlock;
 struct sleeplock;
+struct spawnact;
 struct stat;
 struct superblock;
 
@@ -23,7 +27,11 @@ void            consoleintr(int);
 void            consputc(int);
 
 // exec.c
+void            execinit(void);
+struct seg*     seglookup(struct proc*, uint64);
+uint64          segload(pagetable_t, struct proc*, struct seg*, uint64);
 int             kexec(char*, char**);
+int             kexecproc(struct proc*, char*, char**);
 
 // file.c
 struct file*    filealloc(void);
@@ -40,6 +48,8 @@ int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
+struct inode*   iexecdup(struct inode*);
+void            iexecput(struct inode*);
 void            iinit();
 void            ilock(struct inode*);
 void            iput(struct inode*);
@@ -59,6 +69,15 @@ void            ireclaim(int);
 void*           kalloc(void);
 void            kfree(void *);
 void            kinit(void);
+int             kalloc_n(void **, int);
+void            kfree_n(void **, int);
+void*           kalloc_order(int);
+void            kfree_order(void *, int);
+void*           kalloc_zeroed(void);
+void            kzero_refill(void);
+void            kdup(void *);
+void            ksplit(void *, int);
+int             krefcnt(void *);
 
 // log.c
 void            initlog(int, struct superblock*);
@@ -66,7 +85,46 @@ void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
 
+// mmap.c
+struct vma*     vmalookup(struct proc*, uint64);
+uint64          vmabottom(struct proc*);
+int             vmaperm(struct vma*);
+uint64          vmaload(pagetable_t, struct vma*, uint64);
+void*           readpage(struct inode*, uint, uint);
+uint64          mapfile(pagetable_t, uint64, struct inode*, uint, uint, int);
+
+// swap.c
+void            swapinit(void);
+int             swapsize(void);
+void            swapdup(int);
+void            swapfree(int);
+int             swapreclaim(void);
+void*           kalloc_reclaim(int);
+uint64          swapin(pte_t*);
+
+// zram.c
+void            zraminit(void);
+int             zramcompress(void*);
+void            zramsave(int, int, void**);
+void            zramload(int, void*);
+void            zramfree(int);
+
+// ksm.c
+void            ksminit(void);
+void            ksmscan(void);
+int             ksmsaved(void);
+
+// pcache.c
+void            pcacheinit(void);
+uint64          pcache_map(pagetable_t, uint64, struct inode*, uint, uint, int);
+void            pcache_inval(struct inode*);
+uint64          kmmap(uint64, int, int, struct file*, uint64);
+int             kmunmap(uint64, uint64);
+void            kmunmapall(struct proc*);
+int             vmafork(struct proc*, struct proc*);
+
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
@@ -81,10 +139,11 @@ void            printfinit(void);
 int             cpuid(void);
 void            kexit(int);
 int             kfork(void);
+int             kspawn(char*, char**, struct spawnact*, int);
 int             growproc(int);
 void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
-void            proc_freepagetable(pagetable_t, uint64);
+void            proc_freepagetable(struct proc*, pagetable_t, uint64);
 int             kkill(int);
 int             killed(struct proc*);
 void            setkilled(struct proc*);
@@ -98,6 +157,11 @@ void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             kwait(uint64);
 void            wakeup(void*);
+void            wakeup_one(void*);
+int             timeslice(void);
+void            runqboost(void);
+void            runqlens(int*);
+int             ksetpriority(int, int);
 void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
@@ -106,6 +170,10 @@ void            procdump(void);
 // swtch.S
 void            swtch(struct context*, struct context*);
 
+// ucopy.S
+int             ucopy(void *, void *, uint64);
+int             ucopystr(char *, char *, uint64);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
@@ -114,6 +182,11 @@ void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
 
+// slab.c
+void            kmem_cache_init(struct kmem_cache*, char*, uint);
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
@@ -136,13 +209,22 @@ void            argaddr(int, uint64 *);
 int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
 void            syscall();
+uint64          syscallfast(void);
+
+// timer.c
+void            timerqinit(void);
+int             timerintr(void);
+void            timerbusy(void);
+void            timeridle(void);
+int             timersleep(uint64);
 
 // trap.c
 extern uint     ticks;
 void            trapinit(void);
 void            trapinithart(void);
 extern struct spinlock tickslock;
-void            prepare_return(void);
+uint64          prepare_return(void);
+void            ipi(int);
 
 // uart.c
 void            uartinit(void);
@@ -154,6 +236,16 @@ int             uartgetc(void);
 // vm.c
 void            kvminit(void);
 void            kvminithart(void);
+uint64          kvmsatp(void);
+void            kvmuse(void);
+uint64          uvmsatp(struct proc*);
+uint64          uvmasidgen(void);
+void            tlbflush(pagetable_t, uint64);
+pte_t*          uvmswappable(pagetable_t, uint64);
+pte_t*          uvmmergeable(pagetable_t, uint64);
+void            uvmmerge(pte_t*, uint64);
+int             uvmmapkernel(pagetable_t, struct proc*);
+void            uvmunmapkernel(pagetable_t, struct proc*);
 void            kvmmap(pagetable_t, uint64, uint64, uint64, int);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
 pagetable_t     uvmcreate(void);
@@ -168,7 +260,10 @@ uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
+int             ucopyfault(uint64, int);
 int             ismapped(pagetable_t, uint64);
+uint64          uvmspecused(pagetable_t, uint64, uint64);
+int             uvmcopyrange(pagetable_t, pagetable_t, uint64, uint64, int);
 uint64          vmfault(pagetable_t, uint64, int);
 
 // plic.c
@@ -180,6 +275,7 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_rwpage(uint, void *, int);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
@@ -5,9 +5,36 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
 #include "elf.h"
+#include "slab.h"
 
-static int loadseg(pde_t *, uint64, struct inode *, uint, uint);
+// buffers for #! interpreter paths.
+static struct kmem_cache pathcache;
+
+void
+execinit(void)
+{
+  kmem_cache_init(&pathcache, "exec path", MAXPATH);
+}
+
+// Remove the n interpreter paths that kexec() pushed
+// onto the front of argv.
+static void
+dropinterp(char **argv, int n)
+{
+  int i;
+
+  if(n == 0)
+    return;
+  for(i = 0; i < n; i++)
+    kmem_cache_free(&pathcache, argv[i]);
+  for(i = 0; argv[i+n]; i++)
+    argv[i] = argv[i+n];
+  argv[i] = 0;
+}
 
 int flags2perm(int flags)
 {
@@ -21,15 +48,25 @@ int flags2perm(int flags)
 
 int
 kexec(char *path, char **argv)
+{
+  return kexecproc(myproc(), path, argv);
+}
+
+// Replace p's program with the one in path. p is either
+// the caller, or a new process that spawn() is setting up
+// and that hasn't run yet. Returns argc, or -1.
+int
+kexecproc(struct proc *p, char *path, char **argv)
 {
   char *s, *last;
   int i, off;
   uint64 argc, sz = 0, sp, ustack[MAXARG], stackbase;
   struct elfhdr elf;
-  struct inode *ip;
+  struct inode *ip, *execip = 0, *oldip;
   struct proghdr ph;
+  struct seg seg[NSEG];
+  int nseg = 0;
   pagetable_t pagetable = 0, oldpagetable;
-  struct proc *p = myproc();
   
   // Counter to prevent infinite recursion
   int recursion_depth = 0;
@@ -39,6 +76,7 @@ kexec(char *path, char **argv)
  retry:
   if((ip = namei(path)) == 0){
     end_op();
+    dropinterp(argv, recursion_depth);
     return -1;
   }
   ilock(ip);
@@ -59,7 +97,6 @@ kexec(char *path, char **argv)
           if(recursion_depth > 5) {
               goto bad;
           }
-          recursion_depth++;
 
           // Parse interpreter path
           char interpreter[MAXPATH];
@@ -86,6 +123,7 @@ kexec(char *path, char **argv)
 
           if(count >= MAXARG - 1){
               end_op();
+              dropinterp(argv, recursion_depth);
               return -1;
           }
 
@@ -93,13 +131,17 @@ kexec(char *path, char **argv)
               argv[m+1] = argv[m];
           }
 
-          char *new_interp_str = kalloc();
+          char *new_interp_str = kmem_cache_alloc(&pathcache);
           if(new_interp_str == 0){
+              for(int m = 0; m <= count; m++)
+                  argv[m] = argv[m+1];
               end_op();
+              dropinterp(argv, recursion_depth);
               return -1;
           }
-          safestrcpy(new_interp_str, interpreter, PGSIZE);
+          safestrcpy(new_interp_str, interpreter, MAXPATH);
           argv[0] = new_interp_str;
+          recursion_depth++;
 
           path = new_interp_str;
           goto retry;
@@ -112,6 +154,9 @@ kexec(char *path, char **argv)
   if((pagetable = proc_pagetable(p)) == 0)
     goto bad;
 
+  // don't read the segments in; just note where they are,
+  // for vmfault() to read pages in as they are used.
+  memset(seg, 0, sizeof(seg));
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -123,22 +168,34 @@ kexec(char *path, char **argv)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
-    uint64 sz1;
-    if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
+    if(ph.vaddr < PGROUNDUP(sz) || ph.vaddr + ph.memsz > HEAPTOP)
+      goto bad;
+    if(ph.off + ph.filesz < ph.off || ph.off + ph.filesz > ip->size)
       goto bad;
-    sz = sz1;
-    if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(ph.memsz == 0)
+      continue;
+    if(nseg >= NSEG)
       goto bad;
+    seg[nseg].va = ph.vaddr;
+    seg[nseg].filesz = ph.filesz;
+    seg[nseg].memsz = ph.memsz;
+    seg[nseg].off = ph.off;
+    seg[nseg].perm = PTE_R | PTE_U | flags2perm(ph.flags);
+    nseg++;
+    sz = ph.vaddr + ph.memsz;
   }
+  // keep a reference, to read the pages from.
+  execip = iexecdup(ip);
   iunlockput(ip);
   end_op();
   ip = 0;
 
-  p = myproc();
   uint64 oldsz = p->sz;
 
   sz = PGROUNDUP(sz);
   uint64 sz1;
+  if(sz + (USERSTACK+1)*PGSIZE > HEAPTOP)
+    goto bad;
   if((sz1 = uvmalloc(pagetable, sz, sz + (USERSTACK+1)*PGSIZE, PTE_W)) == 0)
     goto bad;
   sz = sz1;
@@ -173,42 +230,72 @@ kexec(char *path, char **argv)
       last = s+1;
   safestrcpy(p->name, last, sizeof(p->name));
     
+  kmunmapall(p);
   oldpagetable = p->pagetable;
+  p->nspecused += uvmspecused(oldpagetable, 0, oldsz);
   p->pagetable = pagetable;
+  p->asidgen = 0;  // a fresh ASID, with no stale TLB entries
   p->sz = sz;
+  p->guard = stackbase - PGSIZE;
   p->trapframe->epc = elf.entry; 
   p->trapframe->sp = sp; 
-  proc_freepagetable(oldpagetable, oldsz);
+  oldip = p->execip;
+  p->execip = execip;
+  memmove(p->seg, seg, sizeof(seg));
+  kvmuse();  // this hart may be on the old page table
+  proc_freepagetable(p, oldpagetable, oldsz);
+  if(oldip){
+    begin_op();
+    iexecput(oldip);
+    end_op();
+  }
+  dropinterp(argv, recursion_depth);
 
   return argc; 
 
  bad:
   if(pagetable)
-    proc_freepagetable(pagetable, sz);
+    proc_freepagetable(p, pagetable, sz);
   if(ip){
     iunlockput(ip);
     end_op();
   }
+  if(execip){
+    begin_op();
+    iexecput(execip);
+    end_op();
+  }
+  dropinterp(argv, recursion_depth);
   return -1;
 }
 
-static int
-loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz)
+// The segment of p's program that va lies in, or 0.
+struct seg*
+seglookup(struct proc *p, uint64 va)
+{
+  struct seg *sg;
+
+  for(sg = p->seg; sg < &p->seg[NSEG]; sg++)
+    if(sg->memsz && va >= sg->va && va < sg->va + sg->memsz)
+      return sg;
+  return 0;
+}
+
+// Read in and map the page at va of segment sg of p's
+// program. Returns its physical address, or 0.
+uint64
+segload(pagetable_t pagetable, struct proc *p, struct seg *sg, uint64 va)
 {
-  uint i, n;
-  uint64 pa;
-
-  for(i = 0; i < sz; i += PGSIZE){
-    pa = walkaddr(pagetable, va + i);
-    if(pa == 0)
-      panic("loadseg: address should exist");
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
+  uint64 n = 0;
+
+  if(va < sg->va + sg->filesz){
+    n = sg->va + sg->filesz - va;
+    if(n > PGSIZE)
       n = PGSIZE;
-    if(readi(ip, 0, (uint64)pa, offset+i, n) != n)
-      return -1;
   }
-  
-  return 0;
+  // read-only pages, such as text, can be shared with
+  // other processes running the same program.
+  if((sg->perm & PTE_W) == 0 && n > 0)
+    return pcache_map(pagetable, va, p->execip, sg->off + (va - sg->va), n, sg->perm);
+  return mapfile(pagetable, va, p->execip, sg->off + (va - sg->va), n, sg->perm);
 }
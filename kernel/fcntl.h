@@ -4,3 +4,12 @@
 #define O_CREATE  0x200
 #define O_TRUNC   0x400
 #define O_APPEND  0x004
+
+// mmap()
+#define PROT_READ   0x1
+#define PROT_WRITE  0x2
+#define PROT_EXEC   0x4
+
+#define MAP_SHARED  0x01
+#define MAP_PRIVATE 0x02
+#define MAP_ANON    0x20
@@ -18,6 +18,13 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  int nexec;          // processes running it (p->execip); itable.lock
+
+  // pcache.lock protects these; see pcache.c.
+  int npcache;        // pages of it in the pcache, or more
+  int pcreading;      // pages of it pcache_map() is reading in
+  uint pcgen;         // pcache_inval()s of it so far
+
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -272,6 +272,10 @@ iget(uint dev, uint inum)
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  // pages of it may still be cached from before it was
+  // last in the table; pcache_inval() will have to look.
+  ip->npcache = 1;
+  ip->pcreading = 0;
   release(&itable.lock);
 
   return ip;
@@ -288,6 +292,31 @@ idup(struct inode *ip)
   return ip;
 }
 
+// Like idup(), for a process that runs ip's program and
+// reads its pages in from ip as they're used (see segload()).
+// Until iexecput(), writei() and open() refuse to change ip.
+// Caller must hold ip's lock, or another process must be
+// running it already.
+struct inode*
+iexecdup(struct inode *ip)
+{
+  acquire(&itable.lock);
+  ip->ref++;
+  ip->nexec++;
+  release(&itable.lock);
+  return ip;
+}
+
+// Undo iexecdup(). Must be inside a transaction, like iput().
+void
+iexecput(struct inode *ip)
+{
+  acquire(&itable.lock);
+  ip->nexec--;
+  release(&itable.lock);
+  iput(ip);
+}
+
 // Lock the given inode.
 // Reads the inode from disk if necessary.
 void
@@ -452,6 +481,7 @@ itrunc(struct inode *ip)
   struct buf *bp;
   uint *a;
 
+  pcache_inval(ip);
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -535,6 +565,9 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
+  if(ip->nexec)
+    return -1;  // a running program; see iexecdup()
+  pcache_inval(ip);
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     uint addr = bmap(ip, off/BSIZE);
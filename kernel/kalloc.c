@@ -1,6 +1,28 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and pipe buffers. Allocates whole 4096-byte pages,
+// or physically contiguous blocks of 2^order pages.
+//
+// Free memory is kept by a buddy allocator: there is one
+// free list per order, and a freed block is merged with
+// its buddy (the block it was split from) whenever that
+// buddy is free too.
+//
+// Each hart keeps a small cache of free pages so that
+// kalloc() and kfree() usually don't touch kmem.lock.
+// A hart refills its cache from, and spills it to, the
+// buddy allocator KCACHEBATCH pages at a time.
+//
+// Idle harts also fill a pool of already-zeroed pages, so
+// that kalloc_zeroed() rarely has to clear a page itself.
+//
+// Allocated pages are reference counted, so that several
+// page tables can share one page (see uvmcopy() in vm.c);
+// kfree() only frees a page when its last reference goes.
+//
+// Building with -DKPOISON (make KPOISON=1) fills pages
+// with junk as they are allocated and freed, to catch
+// uses of uninitialized or freed memory.
 
 #include "types.h"
 #include "param.h"
@@ -16,17 +38,54 @@ extern char end[]; // first address after kernel.
 
 struct run {
   struct run *next;
+  struct run *prev;  // only used on the buddy free lists
 };
 
+#define NPAGE      ((PHYSTOP - KERNBASE) / PGSIZE)
+#define PGIDX(pa)  (((uint64)(pa) - KERNBASE) / PGSIZE)
+#define IDXPG(i)   ((struct run*)(KERNBASE + (uint64)(i) * PGSIZE))
+
+#define KFREE      0x80  // kmem.order[]: page heads a free block
+
 struct {
   struct spinlock lock;
-  struct run *freelist;
+  struct run free[KMAXORDER+1];  // list heads, one per order
+  // for the first page of each free block, KFREE|order.
+  // zero for every other page.
+  uchar order[NPAGE];
 } kmem;
 
+// reference count of each allocated page (of the first page,
+// for blocks from kalloc_order()). updated with atomic
+// instructions rather than under a lock.
+int kref[NPAGE];
+
+// per-hart page cache. the lock is only contended
+// when another hart steals pages from this one.
+struct kcache {
+  struct spinlock lock;
+  struct run *freelist;
+  int nfree;
+} kcache[NCPU];
+
+// pages that have already been zeroed.
+struct {
+  struct spinlock lock;
+  struct run *freelist;
+  int n;
+} kzero;
+
 void
 kinit()
 {
   initlock(&kmem.lock, "kmem");
+  for(int k = 0; k <= KMAXORDER; k++){
+    kmem.free[k].next = &kmem.free[k];
+    kmem.free[k].prev = &kmem.free[k];
+  }
+  for(int i = 0; i < NCPU; i++)
+    initlock(&kcache[i].lock, "kcache");
+  initlock(&kzero.lock, "kzero");
   freerange(end, (void*)PHYSTOP);
 }
 
@@ -35,31 +94,195 @@ freerange(void *pa_start, void *pa_end)
 {
   char *p;
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE){
+    kref[PGIDX(p)] = 1;
     kfree(p);
+  }
+}
+
+static void
+kcheck(void *pa, int order, char *s)
+{
+  if(((uint64)pa % (PGSIZE << order)) != 0 || (char*)pa < end ||
+     (uint64)pa + (PGSIZE << order) > PHYSTOP)
+    panic(s);
+}
+
+// Return a 2^order page block to the buddy lists,
+// merging it with its buddy for as long as possible.
+// Caller holds kmem.lock.
+static void
+buddy_free(void *pa, int order)
+{
+  uint64 i, b;
+  struct run *r;
+
+  i = PGIDX(pa);
+  while(order < KMAXORDER){
+    b = i ^ (1L << order);
+    if(b >= NPAGE || kmem.order[b] != (KFREE|order))
+      break;
+    // the buddy is free and just as big; take it
+    // off its list and continue with the merged block.
+    r = IDXPG(b);
+    r->prev->next = r->next;
+    r->next->prev = r->prev;
+    kmem.order[b] = 0;
+    i &= ~(1L << order);
+    order++;
+  }
+
+  r = IDXPG(i);
+  kmem.order[i] = KFREE|order;
+  r->next = kmem.free[order].next;
+  r->prev = &kmem.free[order];
+  kmem.free[order].next->prev = r;
+  kmem.free[order].next = r;
+}
+
+// Take a 2^order page block off the buddy lists,
+// splitting a larger block if there is no free block
+// of the right size. Returns 0 if none is available.
+// Caller holds kmem.lock.
+static void *
+buddy_alloc(int order)
+{
+  struct run *r, *b;
+  uint64 i;
+  int k;
+
+  for(k = order; k <= KMAXORDER; k++)
+    if(kmem.free[k].next != &kmem.free[k])
+      break;
+  if(k > KMAXORDER)
+    return 0;
+
+  r = kmem.free[k].next;
+  r->prev->next = r->next;
+  r->next->prev = r->prev;
+  i = PGIDX(r);
+  kmem.order[i] = 0;
+
+  // give back the upper half until the block is small enough.
+  while(k > order){
+    k--;
+    b = IDXPG(i + (1L << k));
+    kmem.order[PGIDX(b)] = KFREE|k;
+    b->next = kmem.free[k].next;
+    b->prev = &kmem.free[k];
+    kmem.free[k].next->prev = b;
+    kmem.free[k].next = b;
+  }
+  return (void*)r;
+}
+
+// Move up to n pages from the buddy allocator to kc.
+// Caller holds kc->lock.
+static void
+krefill(struct kcache *kc, int n)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  while(n-- > 0 && (r = buddy_alloc(0)) != 0){
+    r->next = kc->freelist;
+    kc->freelist = r;
+    kc->nfree++;
+  }
+  release(&kmem.lock);
+}
+
+// Move n pages from kc back to the buddy allocator.
+// Caller holds kc->lock.
+static void
+kspill(struct kcache *kc, int n)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  while(n-- > 0 && (r = kc->freelist) != 0){
+    kc->freelist = r->next;
+    kc->nfree--;
+    buddy_free(r, 0);
+  }
+  release(&kmem.lock);
+}
+
+// The buddy lists and this hart's cache are empty;
+// take a page from some other hart's cache, or from
+// the pool of zeroed pages.
+static struct run *
+ksteal(void)
+{
+  struct kcache *kc;
+  struct run *r;
+
+  for(kc = kcache; kc < &kcache[NCPU]; kc++){
+    acquire(&kc->lock);
+    r = kc->freelist;
+    if(r){
+      kc->freelist = r->next;
+      kc->nfree--;
+      release(&kc->lock);
+      return r;
+    }
+    release(&kc->lock);
+  }
+
+  acquire(&kzero.lock);
+  r = kzero.freelist;
+  if(r){
+    kzero.freelist = r->next;
+    kzero.n--;
+  }
+  release(&kzero.lock);
+  return r;
+}
+
+// Drop a reference to the page at pa, and return
+// the number of references that remain.
+static int
+kput(void *pa)
+{
+  int n;
+
+  if((n = __sync_sub_and_fetch(&kref[PGIDX(pa)], 1)) < 0)
+    panic("kput");
+  return n;
 }
 
 // Free the page of physical memory pointed at by pa,
 // which normally should have been returned by a
 // call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
+// If the page is shared, just drop this reference.
 void
 kfree(void *pa)
 {
   struct run *r;
+  struct kcache *kc;
 
-  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
-    panic("kfree");
+  kcheck(pa, 0, "kfree");
+  if(kput(pa) > 0)
+    return;
 
+#ifdef KPOISON
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
+#endif
 
   r = (struct run*)pa;
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  push_off();
+  kc = &kcache[cpuid()];
+  acquire(&kc->lock);
+  r->next = kc->freelist;
+  kc->freelist = r;
+  kc->nfree++;
+  if(kc->nfree > KCACHEMAX)
+    kspill(kc, KCACHEBATCH);
+  release(&kc->lock);
+  pop_off();
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -69,14 +292,274 @@ void *
 kalloc(void)
 {
   struct run *r;
+  struct kcache *kc;
+
+  push_off();
+  kc = &kcache[cpuid()];
+  acquire(&kc->lock);
+  if(kc->freelist == 0)
+    krefill(kc, KCACHEBATCH);
+  r = kc->freelist;
+  if(r){
+    kc->freelist = r->next;
+    kc->nfree--;
+  }
+  release(&kc->lock);
+  pop_off();
+
+  if(r == 0)
+    r = ksteal();
+  if(r == 0)
+    return 0;
+
+  kref[PGIDX(r)] = 1;
+#ifdef KPOISON
+  memset((char*)r, 5, PGSIZE); // fill with junk
+#endif
+  return (void*)r;
+}
+
+// Turn a block from kalloc_order() into 2^order separate
+// pages, each of which must eventually be freed by kfree().
+void
+ksplit(void *pa, int order)
+{
+  int i, ref;
+
+  kcheck(pa, order, "ksplit");
+  ref = kref[PGIDX(pa)];
+  for(i = 1; i < (1 << order); i++)
+    kref[PGIDX(pa) + i] = ref;
+}
+
+// Add a reference to the allocated page at pa,
+// which kfree() will then have to drop as well.
+void
+kdup(void *pa)
+{
+  kcheck(pa, 0, "kdup");
+  if(__sync_fetch_and_add(&kref[PGIDX(pa)], 1) <= 0)
+    panic("kdup");
+}
+
+// The number of references to the page at pa.
+int
+krefcnt(void *pa)
+{
+  kcheck(pa, 0, "krefcnt");
+  return __atomic_load_n(&kref[PGIDX(pa)], __ATOMIC_RELAXED);
+}
+
+// Give n unreferenced pages back to the buddy allocator.
+static void
+kfree_pages(void **pa, int n)
+{
+  int i;
+
+  if(n <= 0)
+    return;
+
+#ifdef KPOISON
+  for(i = 0; i < n; i++)
+    memset(pa[i], 1, PGSIZE);
+#endif
+
+  acquire(&kmem.lock);
+  for(i = 0; i < n; i++)
+    buddy_free(pa[i], 0);
+  release(&kmem.lock);
+}
+
+// Free the n pages in pa[] with a single trip
+// through kmem.lock. Shared pages just lose a
+// reference. Reorders pa[].
+void
+kfree_n(void **pa, int n)
+{
+  int i, m;
+
+  m = 0;
+  for(i = 0; i < n; i++){
+    kcheck(pa[i], 0, "kfree_n");
+    if(kput(pa[i]) == 0)
+      pa[m++] = pa[i];
+  }
+  kfree_pages(pa, m);
+}
+
+// Allocate n pages into pa[], taking them from this hart's
+// cache and then the buddy allocator, with at most one trip
+// through kmem.lock. Either all n pages are allocated and
+// n is returned, or none are and 0 is returned.
+int
+kalloc_n(void **pa, int n)
+{
+  struct kcache *kc;
+  struct run *r;
+  int i = 0;
+
+  push_off();
+  kc = &kcache[cpuid()];
+  acquire(&kc->lock);
+  while(i < n && (r = kc->freelist) != 0){
+    kc->freelist = r->next;
+    kc->nfree--;
+    pa[i++] = r;
+  }
+  release(&kc->lock);
+  pop_off();
+
+  if(i < n){
+    acquire(&kmem.lock);
+    while(i < n && (pa[i] = buddy_alloc(0)) != 0)
+      i++;
+    release(&kmem.lock);
+  }
+
+  // nearly out of memory; look in other harts' caches.
+  while(i < n && (pa[i] = ksteal()) != 0)
+    i++;
+
+  if(i < n){
+    kfree_pages(pa, i);
+    return 0;
+  }
+
+  for(i = 0; i < n; i++){
+    kref[PGIDX(pa[i])] = 1;
+#ifdef KPOISON
+    memset(pa[i], 5, PGSIZE); // fill with junk
+#endif
+  }
+  return n;
+}
+
+// Give every page in every hart's cache, and in the
+// zeroed pool, back to the buddy allocator, so that
+// they can be merged into larger blocks.
+static void
+kdrain(void)
+{
+  struct kcache *kc;
+  struct run *r;
+
+  for(kc = kcache; kc < &kcache[NCPU]; kc++){
+    acquire(&kc->lock);
+    kspill(kc, kc->nfree);
+    release(&kc->lock);
+  }
 
+  acquire(&kzero.lock);
   acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
+  while((r = kzero.freelist) != 0){
+    kzero.freelist = r->next;
+    kzero.n--;
+    buddy_free(r, 0);
+  }
   release(&kmem.lock);
+  release(&kzero.lock);
+}
 
-  if(r)
-    memset((char*)r, 5, PGSIZE); // fill with junk
+// Allocate 2^order physically contiguous pages,
+// aligned to their size. Returns 0 if there is no
+// free block that large.
+void *
+kalloc_order(int order)
+{
+  void *pa;
+
+  if(order < 0 || order > KMAXORDER)
+    return 0;
+  if(order == 0)
+    return kalloc();
+
+  acquire(&kmem.lock);
+  pa = buddy_alloc(order);
+  release(&kmem.lock);
+
+  if(pa == 0){
+    // the pages we need might be sitting in hart caches.
+    kdrain();
+    acquire(&kmem.lock);
+    pa = buddy_alloc(order);
+    release(&kmem.lock);
+  }
+
+  if(pa == 0)
+    return 0;
+
+  kref[PGIDX(pa)] = 1;
+#ifdef KPOISON
+  memset(pa, 5, PGSIZE << order); // fill with junk
+#endif
+  return pa;
+}
+
+// Free a block of 2^order pages allocated by kalloc_order().
+void
+kfree_order(void *pa, int order)
+{
+  if(order == 0){
+    kfree(pa);
+    return;
+  }
+  if(order < 0 || order > KMAXORDER)
+    panic("kfree_order");
+  kcheck(pa, order, "kfree_order");
+  if(kput(pa) > 0)
+    return;
+
+#ifdef KPOISON
+  // Fill with junk to catch dangling refs.
+  memset(pa, 1, PGSIZE << order);
+#endif
+
+  acquire(&kmem.lock);
+  buddy_free(pa, order);
+  release(&kmem.lock);
+}
+
+// Allocate one page of physical memory, filled with zeros.
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_zeroed(void)
+{
+  struct run *r;
+
+  acquire(&kzero.lock);
+  r = kzero.freelist;
+  if(r){
+    kzero.freelist = r->next;
+    kzero.n--;
+  }
+  release(&kzero.lock);
+
+  if(r){
+    r->next = 0;  // the only non-zero word
+    kref[PGIDX(r)] = 1;
+    return (void*)r;
+  }
+
+  if((r = kalloc()) != 0)
+    memset(r, 0, PGSIZE);
   return (void*)r;
 }
+
+// Zero a few free pages for kalloc_zeroed().
+// Called by idle harts from scheduler().
+void
+kzero_refill(void)
+{
+  struct run *r;
+
+  for(int i = 0; i < KZEROBATCH && kzero.n < KZEROMAX; i++){
+    if((r = kalloc()) == 0)
+      break;
+    memset(r, 0, PGSIZE);
+    acquire(&kzero.lock);
+    r->next = kzero.freelist;
+    kzero.freelist = r;
+    kzero.n++;
+    release(&kzero.lock);
+  }
+}
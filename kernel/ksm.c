@@ -0,0 +1,251 @@
+//
+// Same-page merging: idle harts scan user memory for
+// private pages with identical contents, such as the data
+// and bss of several copies of one program, and map a
+// single copy-on-write frame in their place. A write
+// fault gives the writer its own copy again (cowcopy()).
+//
+// Each page scanned is hashed. A page of zeros is merged
+// with the kernel's zero page. Otherwise, if the stable
+// table holds a frame with the same contents, the page is
+// merged with it; if the unstable table remembers another
+// page with the same contents, this page becomes a stable
+// frame, read-only from now on, for the other page (and
+// any more) to be merged with when the scan reaches it.
+// The stable table holds a reference to each frame, and
+// drops frames that nothing maps any more.
+//
+// At most KSMBATCH pages are scanned per clock tick.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "fcntl.h"
+#include "kstat.h"
+
+extern struct proc proc[NPROC];
+extern struct kstat kstat;
+extern uint ticks;
+
+// a page seen by the scan, which may be seen again.
+struct ksmpage {
+  uint hash;
+  int pid;
+  uint64 va;
+  uint64 pa;  // may since have been freed
+};
+
+struct {
+  struct spinlock lock;
+  void *stable[NKSM];              // shared frames, by hash
+  struct ksmpage unstable[NKSM];   // candidates, by hash
+
+  uint tick;                 // when this tick's batch began,
+  int scanned;               // and how much of it is done.
+  int hand;                  // scan position: proc[hand],
+  int region;                // 0 for its memory, i for vma[i-1],
+  uint64 va;                 // at this address.
+} ksm;
+
+void
+ksminit(void)
+{
+  initlock(&ksm.lock, "ksm");
+}
+
+// Hash a page; 0 if it's all zeros.
+static uint
+ksmhash(void *pa)
+{
+  uint64 *w = (uint64*)pa;
+  uint64 h = 0;
+  int i;
+
+  for(i = 0; i < PGSIZE/8; i++)
+    h = (h ^ w[i]) * 0x100000001b3ULL;
+  return h ^ (h >> 32);
+}
+
+static int
+iszero(void *pa)
+{
+  uint64 *w = (uint64*)pa;
+  int i;
+
+  for(i = 0; i < PGSIZE/8; i++)
+    if(w[i])
+      return 0;
+  return 1;
+}
+
+// Look at p's page at va, whose PTE is pte, and merge it
+// if possible. Caller holds ksm.lock and p->lock, and p
+// isn't running.
+static void
+ksmpage(struct proc *p, uint64 va, pte_t *pte)
+{
+  void *pa = (void*)PTE2PA(*pte);
+  void **s;
+  struct ksmpage *u;
+  uint h;
+
+  kstat.ksmscan++;
+  h = ksmhash(pa);
+  if(h == 0 && iszero(pa)){
+    uvmmerge(pte, 0);
+    goto merged;
+  }
+
+  s = &ksm.stable[h % NKSM];
+  if(*s && memcmp(*s, pa, PGSIZE) == 0){
+    uvmmerge(pte, (uint64)*s);
+    goto merged;
+  }
+
+  u = &ksm.unstable[h % NKSM];
+  if(u->pa && u->hash == h && (u->pid != p->pid || u->va != va) &&
+     memcmp((void*)u->pa, pa, PGSIZE) == 0){
+    if(*s && krefcnt(*s) > 1)
+      return;  // the slot is in use
+    // this page becomes the stable frame.
+    if(*s){
+      kfree(*s);
+      kstat.ksmshared--;
+    }
+    kdup(pa);
+    *s = pa;
+    uvmmerge(pte, (uint64)pa);
+    u->pa = 0;
+    kstat.ksmshared++;
+    p->asidgen = 0;
+    return;
+  }
+  u->hash = h;
+  u->pid = p->pid;
+  u->va = va;
+  u->pa = (uint64)pa;
+  return;
+
+ merged:
+  // p's TLB entries, wherever they are, still allow writes.
+  // give p a fresh ASID.
+  p->asidgen = 0;
+  kstat.ksmmerged++;
+}
+
+// How many pages the stable frames save: all but one of
+// the page tables that map each frame would otherwise
+// have their own copy. A frame that only the stable tree
+// still holds (refcount 1, until ksmprune()) saves nothing.
+int
+ksmsaved(void)
+{
+  void **s;
+  int n = 0;
+
+  acquire(&ksm.lock);
+  for(s = ksm.stable; s < &ksm.stable[NKSM]; s++)
+    if(*s && krefcnt(*s) > 2)
+      n += krefcnt(*s) - 2;
+  release(&ksm.lock);
+  return n;
+}
+
+// Free stable frames that are no longer mapped.
+static void
+ksmprune(void)
+{
+  void **s;
+
+  for(s = ksm.stable; s < &ksm.stable[NKSM]; s++){
+    if(*s && krefcnt(*s) == 1){
+      kfree(*s);
+      *s = 0;
+      kstat.ksmshared--;
+    }
+  }
+}
+
+// Scan up to n pages of p's memory from where the scan
+// left off. Returns how many it scanned; fewer than n
+// means it got to the end. Caller holds ksm.lock and p->lock.
+static int
+ksmscanproc(struct proc *p, int n)
+{
+  uint64 start, end;
+  struct vma *v;
+  pte_t *pte;
+  int done = 0;
+
+  for(; ksm.region <= NVMA; ksm.region++, ksm.va = 0){
+    if(ksm.region == 0){
+      start = 0;
+      end = p->sz;
+    } else {
+      v = &p->vma[ksm.region-1];
+      if(v->len == 0 || (v->flags & MAP_SHARED))
+        continue;
+      start = v->addr;
+      end = v->addr + v->len;
+    }
+    if(ksm.va < start)
+      ksm.va = start;
+    while(ksm.va < end){
+      if(done == n)
+        return done;
+      if(walk(p->pagetable, ksm.va, 0) == 0){
+        // no page-table page here; skip its 2MB.
+        ksm.va = ksm.va - ksm.va % MEGAPGSIZE + MEGAPGSIZE;
+        continue;
+      }
+      if((pte = uvmmergeable(p->pagetable, ksm.va)) != 0)
+        ksmpage(p, ksm.va, pte);
+      ksm.va += PGSIZE;
+      done++;
+    }
+  }
+  return done;
+}
+
+// Scan some user memory for pages to merge, unless this
+// tick's batch has been done already. Called by idle harts
+// from scheduler().
+void
+ksmscan(void)
+{
+  struct proc *p;
+  int i;
+
+  if(ksm.tick == ticks && ksm.scanned >= KSMBATCH)
+    return;
+
+  acquire(&ksm.lock);
+  if(ksm.tick != ticks){
+    ksm.tick = ticks;
+    ksm.scanned = 0;
+  }
+  for(i = 0; i < NPROC && ksm.scanned < KSMBATCH; i++){
+    p = &proc[ksm.hand];
+    acquire(&p->lock);
+    // the pages of a running process could change under us.
+    if(p->state == RUNNABLE || p->state == SLEEPING)
+      ksm.scanned += ksmscanproc(p, KSMBATCH - ksm.scanned);
+    else
+      ksm.region = NVMA + 1;
+    release(&p->lock);
+    if(ksm.region > NVMA){
+      // this process is done; on to the next.
+      ksm.region = 0;
+      ksm.va = 0;
+      if(++ksm.hand == NPROC){
+        ksm.hand = 0;
+        ksmprune();
+      }
+    }
+  }
+  release(&ksm.lock);
+}
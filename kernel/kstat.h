@@ -0,0 +1,33 @@
+// system-wide counters, copied out by kstat().
+struct kstat {
+  uint64 uret;          // returns to user space
+  uint64 tlbflush;      // whole-TLB flushes
+  uint64 tlbflushasid;  // flushes of one address space
+  uint64 tlbflushpage;  // flushes of one page
+  uint64 asidgen;       // ASID generation; +1 each time they run out
+  int nasid;            // ASIDs the hardware has, 0 if none
+  uint64 swapout;       // pages written to swap
+  uint64 swapin;        // pages read back from swap
+  int swapused;         // pages of swap space in use
+  int swapsize;         // pages of swap space, 0 if none
+  uint64 zramout;       // of swapout, pages compressed into zram
+  uint64 zramin;        // of swapin, pages decompressed from zram
+  int zramused;         // pages held in zram
+  int zrampool;         // pages of memory zram uses to hold them
+  uint64 zrambytes;     // their total compressed size
+  uint64 swaptime;      // time spent in swapin faults, in r_time() units
+  uint64 zramtime;      // of which for pages in zram
+  uint64 ksmscan;       // pages hashed by same-page merging
+  uint64 ksmmerged;     // pages freed by merging them with identical ones
+  int ksmshared;        // shared frames they were merged into
+  int ksmsaved;         // pages saved by sharing those frames now
+  uint64 runqsteal;     // processes a hart took from another's run queue
+  uint64 wakeup;        // calls to wakeup() and wakeup_one()
+  uint64 wakescan;      // sleeping processes they looked at
+  int runqlen[NPRIO];   // RUNNABLE processes queued at each level
+  uint64 runqpick[NPRIO];  // processes picked to run from each level
+  uint64 runqwait[NPRIO];  // their time spent queued, in r_time() units
+  uint64 clockintr;     // clock interrupts, on all harts
+  uint64 timerwake;     // sleepers they woke
+  uint64 ipi;           // idle harts kicked to run a process
+};
@@ -11,22 +11,30 @@ void
 main()
 {
   if(cpuid() == 0){
+    // the uart is only mapped once paging is on.
+    kinit();         // physical page allocator
+    kvminit();       // create kernel page table
+    kvminithart();   // turn on paging
     consoleinit();
     printfinit();
     printf("\n");
     printf("xv6 kernel is booting\n");
     printf("\n");
-    kinit();         // physical page allocator
-    kvminit();       // create kernel page table
-    kvminithart();   // turn on paging
     procinit();      // process table
     trapinit();      // trap vectors
     trapinithart();  // install kernel trap vector
+    timerqinit();    // per-hart timer queues
     plicinit();      // set up interrupt controller
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
     iinit();         // inode table
     fileinit();      // file table
+    pipeinit();      // pipe object cache
+    execinit();      // exec's #! path cache
+    pcacheinit();    // shared program text
+    swapinit();      // swap space
+    zraminit();      // compressed swap in memory
+    ksminit();       // same-page merging
     virtio_disk_init(); // emulated hard disk
     userinit();      // first user process
     __sync_synchronize();
@@ -35,8 +43,8 @@ main()
     while(started == 0)
       ;
     __sync_synchronize();
-    printf("hart %d starting\n", cpuid());
     kvminithart();    // turn on paging
+    printf("hart %d starting\n", cpuid());
     trapinithart();   // install kernel trap vector
     plicinithart();   // ask PLIC for device interrupts
   }
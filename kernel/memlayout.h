@@ -17,16 +17,31 @@
 // end -- start of kernel page allocation area
 // PHYSTOP -- end RAM used by the kernel
 
+// the kernel maps the devices at DEVBASE plus their
+// physical addresses, next to the RAM at KERNBASE, out of
+// the way of user memory (see HEAPTOP below). so it must
+// turn on paging before it touches any of them.
+#define DEVBASE 0x90000000L
+#define DEVPA(va) ((va) - DEVBASE)
+
 // qemu puts UART registers here in physical memory.
-#define UART0 0x10000000L
+#define UART0 (DEVBASE + 0x10000000L)
 #define UART0_IRQ 10
 
+// the time counter, read by r_time(), counts at 10MHz.
+#define TIMEFREQ 10000000L
+
+// core local interruptor (CLINT), which has a machine-mode
+// software interrupt pending register for each hart.
+#define CLINT (DEVBASE + 0x02000000L)
+#define CLINT_MSIP(hart) (CLINT + 4*(hart))
+
 // virtio mmio interface
-#define VIRTIO0 0x10001000
+#define VIRTIO0 (DEVBASE + 0x10001000L)
 #define VIRTIO0_IRQ 1
 
 // qemu puts platform-level interrupt controller (PLIC) here.
-#define PLIC 0x0c000000L
+#define PLIC (DEVBASE + 0x0c000000L)
 #define PLIC_PRIORITY (PLIC + 0x0)
 #define PLIC_PENDING (PLIC + 0x1000)
 #define PLIC_SENABLE(hart) (PLIC + 0x2080 + (hart)*0x100)
@@ -53,7 +68,25 @@
 //   original data and bss
 //   fixed-size stack
 //   expandable heap
-//   ...
+//   ... up to HEAPTOP
+//   mmap() regions, growing down from MMAPTOP
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+
+#ifdef SPLITPT
+// the kernel has a page table of its own, and switches
+// to it on every trap from user space.
+#define HEAPTOP MMAPTOP
+#define MMAPBASE 0
+#define MMAPTOP TRAPFRAME
+#else
+// the kernel is also mapped into each user page table,
+// without PTE_U, so traps needn't switch page tables:
+// the gigabyte at KERNBASE, shared with the kernel page
+// table, and the process's own kernel stack. user memory
+// must keep clear of them.
+#define HEAPTOP KERNBASE
+#define MMAPBASE (KERNBASE + (1L << 30))
+#define MMAPTOP KSTACK(NPROC)
+#endif
@@ -0,0 +1,330 @@
+//
+// mmap() and munmap(): regions of user memory backed by
+// a file, or by nothing (anonymous). A process's regions
+// are kept in p->vma[], placed top-down below MMAPTOP, and
+// their pages are filled in on demand by vmfault().
+//
+// A MAP_PRIVATE file mapping reads the file into private
+// pages. A MAP_SHARED one writes its dirty pages back to
+// the file, through the log, when it is unmapped; pages
+// are shared with children after fork(), but separate
+// processes that map the same file each get their own
+// copy of it.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "fcntl.h"
+
+// Return the region of p's memory that contains va, or 0.
+struct vma *
+vmalookup(struct proc *p, uint64 va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->len && va >= v->addr && va < v->addr + v->len)
+      return v;
+  return 0;
+}
+
+// The lowest address used by any of p's regions, or
+// HEAPTOP; the heap must stay below it.
+uint64
+vmabottom(struct proc *p)
+{
+  struct vma *v;
+  uint64 bottom = HEAPTOP;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->len && v->addr < bottom)
+      bottom = v->addr;
+  return bottom;
+}
+
+// PTE permission bits for v's pages.
+int
+vmaperm(struct vma *v)
+{
+  int perm = PTE_U;
+
+  if(v->prot & PROT_READ)
+    perm |= PTE_R;
+  if(v->prot & PROT_WRITE)
+    perm |= PTE_R | PTE_W;  // W without R is reserved
+  if(v->prot & PROT_EXEC)
+    perm |= PTE_X;
+  return perm;
+}
+
+// Allocate a page whose first n bytes are read from ip at
+// off, and whose remainder (all of it, past the end of the
+// file) is zero. Returns 0 if out of memory, or if the
+// caller isn't in a position to wait for the disk.
+void *
+readpage(struct inode *ip, uint off, uint n)
+{
+  char *mem;
+  int spin;
+
+  if(n > 0){
+    // can't sleep on the inode lock if the caller holds a
+    // spinlock. and inside readi() or writei() of this very
+    // file, the caller may hold the buffer that we need.
+    push_off();
+    spin = mycpu()->noff > 1;
+    pop_off();
+    if(spin || holdingsleep(&ip->lock))
+      return 0;
+  }
+  if((mem = kalloc_reclaim(1)) == 0)
+    return 0;
+
+  if(n > 0){
+    ilock(ip);
+    readi(ip, 0, (uint64)mem, off, n);
+    iunlock(ip);
+  }
+  return mem;
+}
+
+// Map a new page at va, with permissions perm, read in by
+// readpage(). Returns its physical address, or 0.
+uint64
+mapfile(pagetable_t pagetable, uint64 va, struct inode *ip, uint off, uint n, int perm)
+{
+  char *mem;
+
+  if((mem = readpage(ip, off, n)) == 0)
+    return 0;
+  if(mappages(pagetable, va, PGSIZE, (uint64)mem, perm) != 0){
+    kfree(mem);
+    return 0;
+  }
+  return (uint64)mem;
+}
+
+// Read the page of v's file that backs va into a new page
+// and map it. Returns its physical address, or 0.
+uint64
+vmaload(pagetable_t pagetable, struct vma *v, uint64 va)
+{
+  return mapfile(pagetable, va, v->f->ip, v->off + (va - v->addr),
+                 PGSIZE, vmaperm(v));
+}
+
+// Write the dirty pages of v between va and va+len back
+// to v's file. Never makes the file longer.
+static void
+vmawriteback(pagetable_t pagetable, struct vma *v, uint64 va, uint64 len)
+{
+  // a few blocks at a time, as in filewrite().
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  struct inode *ip = v->f->ip;
+  uint64 a, pa, off;
+  pte_t *pte;
+  int i, n;
+
+  for(a = va; a < va + len; a += PGSIZE){
+    if((pte = walk(pagetable, a, 0)) == 0)
+      continue;
+    if((*pte & PTE_V) == 0 || (*pte & PTE_D) == 0)
+      continue;
+    pa = PTE2PA(*pte);
+    off = v->off + (a - v->addr);
+    for(i = 0; i < PGSIZE; i += max){
+      n = PGSIZE - i;
+      if(n > max)
+        n = max;
+      begin_op();
+      ilock(ip);
+      if(off + i < ip->size){
+        if(off + i + n > ip->size)
+          n = ip->size - (off + i);
+        writei(ip, 0, pa + i, off + i, n);
+      }
+      iunlock(ip);
+      end_op();
+    }
+  }
+}
+
+// Map len bytes of f, starting at off, or anonymous memory
+// if f is 0. Returns the address, or -1.
+uint64
+kmmap(uint64 len, int prot, int flags, struct file *f, uint64 off)
+{
+  struct proc *p = myproc();
+  struct vma *v, *free;
+  uint64 top, addr;
+
+  len = PGROUNDUP(len);
+  if(len == 0 || (off % PGSIZE) != 0)
+    return -1;
+
+  free = 0;
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->len == 0 && free == 0)
+      free = v;
+  if(free == 0)
+    return -1;
+
+  // the highest gap that is big enough, trying
+  // below each region that gets in the way.
+  top = MMAPTOP;
+  for(;;){
+    if(top < len || top - len < PGROUNDUP(p->sz) || top - len < MMAPBASE)
+      return -1;
+    addr = top - len;
+    for(v = p->vma; v < &p->vma[NVMA]; v++)
+      if(v->len && v->addr < top && v->addr + v->len > addr)
+        break;
+    if(v == &p->vma[NVMA])
+      break;
+    top = v->addr;
+  }
+
+  free->addr = addr;
+  free->len = len;
+  free->prot = prot;
+  free->flags = flags;
+  free->f = f ? filedup(f) : 0;
+  free->off = off;
+  return addr;
+}
+
+// Unmap [addr, addr+len) within v, writing shared dirty
+// pages back first, and shrink or split v to match.
+// Returns -1 if a split needs a free slot and there is none.
+static int
+vmaunmap(struct proc *p, struct vma *v, uint64 addr, uint64 len)
+{
+  struct vma *v2;
+
+  if(addr > v->addr && addr + len < v->addr + v->len){
+    // a hole in the middle: the top part becomes a new region.
+    for(v2 = p->vma; v2 < &p->vma[NVMA]; v2++)
+      if(v2->len == 0)
+        break;
+    if(v2 == &p->vma[NVMA])
+      return -1;
+    *v2 = *v;
+    v2->addr = addr + len;
+    v2->len = v->addr + v->len - v2->addr;
+    v2->off = v->off + (v2->addr - v->addr);
+    if(v2->f)
+      filedup(v2->f);
+    v->len = v2->addr - v->addr;
+  }
+
+  if(v->f && (v->flags & MAP_SHARED))
+    vmawriteback(p->pagetable, v, addr, len);
+  uvmunmap(p->pagetable, addr, len / PGSIZE, 1);
+
+  if(addr == v->addr){
+    v->addr += len;
+    v->off += len;
+  }
+  v->len -= len;
+  if(v->len == 0 && v->f){
+    fileclose(v->f);
+    v->f = 0;
+  }
+  return 0;
+}
+
+// Unmap [addr, addr+len), which may cover parts of
+// several regions, or none. Returns 0 or -1.
+int
+kmunmap(uint64 addr, uint64 len)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint64 start, end;
+
+  len = PGROUNDUP(len);
+  if((addr % PGSIZE) != 0 || addr + len < addr || addr + len > MMAPTOP)
+    return -1;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->len == 0)
+      continue;
+    start = addr > v->addr ? addr : v->addr;
+    end = addr + len < v->addr + v->len ? addr + len : v->addr + v->len;
+    if(start < end && vmaunmap(p, v, start, end - start) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+// Unmap all of p's regions. Called by exit and exec.
+void
+kmunmapall(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->len)
+      vmaunmap(p, v, v->addr, v->len);
+}
+
+// Give child np copies of p's regions. Private pages are
+// shared copy-on-write, shared ones stay shared. Returns
+// -1 on failure, having undone any copies. Called by fork
+// with np->lock held, so it must not sleep.
+int
+vmafork(struct proc *p, struct proc *np)
+{
+  struct vma *v, *nv;
+  uint64 a, mem;
+  int i;
+
+  for(i = 0; i < NVMA; i++){
+    v = &p->vma[i];
+    nv = &np->vma[i];
+    if(v->len == 0)
+      continue;
+    if(v->f == 0 && (v->flags & MAP_SHARED)){
+      // the child must see the same pages, so there
+      // can't be any left for each to fault in alone.
+      for(a = v->addr; a < v->addr + v->len; a += PGSIZE){
+        if(ismapped(p->pagetable, a))
+          continue;
+        if((mem = (uint64)kalloc_zeroed()) == 0)
+          goto bad;
+        if(mappages(p->pagetable, a, PGSIZE, mem, vmaperm(v)) != 0){
+          kfree((void*)mem);
+          goto bad;
+        }
+      }
+    }
+    if(uvmcopyrange(p->pagetable, np->pagetable, v->addr, v->addr + v->len,
+                    (v->flags & MAP_SHARED) != 0) < 0)
+      goto bad;
+    *nv = *v;
+    if(nv->f)
+      filedup(nv->f);
+  }
+  return 0;
+
+ bad:
+  // the files are still open in p, so fileclose() won't sleep.
+  for(nv = np->vma; nv < &np->vma[NVMA]; nv++){
+    if(nv->len == 0)
+      continue;
+    uvmunmap(np->pagetable, nv->addr, nv->len / PGSIZE, 1);
+    if(nv->f)
+      fileclose(nv->f);
+    nv->len = 0;
+    nv->f = 0;
+  }
+  return -1;
+}
@@ -1,11 +1,20 @@
 #define NPROC        64  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
+#define NWAITQ       64  // hash buckets of sleeping processes (a power of 2)
+#define NPRIO         4  // run queue levels; a level l time slice is 2^l quanta
+#define MLFQBOOST    20  // ticks between moving every process back up a level
+#define TICKHZ       10  // clock ticks per second, for pause() and uptime()
+#define IDLEPOLL     50  // us an idle hart polls the run queues before wfi
+#ifndef QUANTUM
+#define QUANTUM      10  // ms a process runs before it may be preempted
+#endif
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
 #define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
+#define MAXSPAWNACT  16  // max spawn() file descriptor actions
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGBLOCKS    (MAXOPBLOCKS*3)  // max data blocks in on-disk log
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
@@ -13,3 +22,18 @@
 #define MAXPATH      128   // maximum file path name
 #define USERSTACK    1     // user stack pages
 
+#define KCACHEMAX    64    // max free pages cached per hart
+#define KCACHEBATCH  32    // pages moved between a hart's cache and kmem at once
+#define KMAXORDER    10    // largest kalloc_order() block is 2^KMAXORDER pages
+#define KZEROMAX     256   // max pages in the pre-zeroed pool
+#define KZEROBATCH   8     // pages an idle hart zeroes per scheduler pass
+#define FAULTAROUND  8     // default fault-around window, in pages
+#define MAXFAULTAROUND 64  // largest fault-around window
+#define NVMA         16    // mmap() regions per process
+#define NSEG         4     // loadable segments per program
+#define NPCACHE      256   // shared read-only program pages cached
+#define NSWAP        8192  // pages of swap space, after the file system on disk
+#define SWAPBATCH    16    // pages swapped out at once when memory runs out
+#define NZRAM        8192  // swapped-out pages kept compressed in memory
+#define NKSM         256   // shared frames that same-page merging keeps track of
+#define KSMBATCH     64    // pages idle harts scan for merging per clock tick
@@ -0,0 +1,161 @@
+//
+// Cache of read-only program pages, so that processes
+// running the same binary share its text instead of each
+// reading in a copy.
+//
+// An entry holds one reference to its page, and each page
+// table that maps the page holds another. Entries are
+// keyed by (dev, inum, off, n), n being how many bytes of
+// the page came from the file; writing or truncating the
+// file throws its entries away. When the cache is full,
+// the least recently used entry is replaced.
+//
+// So that writes to other files needn't look through the
+// cache, each inode counts its pages that may be cached,
+// and the pages being read in; pcache_inval() only has
+// work to do if either is non-zero. Evicting a page
+// doesn't lower the count, which may be too high until
+// the next pcache_inval() of the file.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "stat.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+
+struct pcent {
+  uint dev;
+  uint inum;
+  uint off;
+  uint n;
+  void *pa;      // 0 if the entry is free
+  uint64 used;   // pcache.clock at last use
+};
+
+struct {
+  struct spinlock lock;
+  struct pcent ent[NPCACHE];
+  uint64 clock;
+} pcache;
+
+void
+pcacheinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+}
+
+// Look for the page; caller holds pcache.lock.
+static struct pcent *
+pcache_find(uint dev, uint inum, uint off, uint n)
+{
+  struct pcent *e;
+
+  for(e = pcache.ent; e < &pcache.ent[NPCACHE]; e++)
+    if(e->pa && e->dev == dev && e->inum == inum && e->off == off && e->n == n)
+      return e;
+  return 0;
+}
+
+// Map, at va, the page whose first n bytes are ip's
+// bytes at off, sharing the cached copy if there is one,
+// and caching it otherwise. The page must never be
+// mapped writable. Returns its physical address, or 0.
+uint64
+pcache_map(pagetable_t pagetable, uint64 va, struct inode *ip, uint off, uint n, int perm)
+{
+  struct pcent *e, *victim;
+  void *mem, *old;
+  uint gen;
+
+  acquire(&pcache.lock);
+  if((e = pcache_find(ip->dev, ip->inum, off, n)) != 0){
+    e->used = ++pcache.clock;
+    mem = e->pa;
+    kdup(mem);
+    release(&pcache.lock);
+    goto map;
+  }
+  // a write to ip from now on must tell us, by changing
+  // ip->pcgen, that the page we read may be out of date.
+  gen = ip->pcgen;
+  ip->pcreading++;
+  release(&pcache.lock);
+
+  mem = readpage(ip, off, n);
+
+  acquire(&pcache.lock);
+  ip->pcreading--;
+  if(mem == 0){
+    release(&pcache.lock);
+    return 0;
+  }
+  old = 0;
+  if((e = pcache_find(ip->dev, ip->inum, off, n)) != 0){
+    // another process read it in at the same time.
+    old = mem;
+    mem = e->pa;
+    kdup(mem);
+  } else if(gen == ip->pcgen){
+    // not if the file changed while we were reading it.
+    victim = pcache.ent;
+    for(e = pcache.ent; e < &pcache.ent[NPCACHE]; e++){
+      if(e->pa == 0){
+        victim = e;
+        break;
+      }
+      if(e->used < victim->used)
+        victim = e;
+    }
+    old = victim->pa;
+    victim->dev = ip->dev;
+    victim->inum = ip->inum;
+    victim->off = off;
+    victim->n = n;
+    victim->pa = mem;
+    victim->used = ++pcache.clock;
+    ip->npcache++;
+    kdup(mem);
+  }
+  release(&pcache.lock);
+  if(old)
+    kfree(old);
+
+ map:
+  if(mappages(pagetable, va, PGSIZE, (uint64)mem, perm) != 0){
+    kfree(mem);
+    return 0;
+  }
+  return (uint64)mem;
+}
+
+// ip's contents are changing; forget its cached pages.
+// Processes that have them mapped keep them. Caller
+// holds ip->lock.
+void
+pcache_inval(struct inode *ip)
+{
+  struct pcent *e;
+
+  // only files are run as programs.
+  if(ip->type != T_FILE)
+    return;
+
+  acquire(&pcache.lock);
+  if(ip->pcreading)
+    ip->pcgen++;
+  if(ip->npcache){
+    for(e = pcache.ent; e < &pcache.ent[NPCACHE]; e++){
+      if(e->pa && e->dev == ip->dev && e->inum == ip->inum){
+        kfree(e->pa);
+        e->pa = 0;
+      }
+    }
+    ip->npcache = 0;
+  }
+  release(&pcache.lock);
+}
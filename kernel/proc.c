@@ -5,6 +5,9 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "spawn.h"
+#include "kstat.h"
+#include "vm.h"
 
 struct cpu cpus[NCPU];
 
@@ -17,6 +20,7 @@ struct spinlock pid_lock;
 
 extern void forkret(void);
 static void freeproc(struct proc *p);
+static void setrunnable(struct proc *p);
 
 extern char trampoline[]; // trampoline.S
 
@@ -26,6 +30,40 @@ extern char trampoline[]; // trampoline.S
 // must be acquired before any p->lock.
 struct spinlock wait_lock;
 
+// per-hart queues of RUNNABLE processes, one for each
+// priority level, in the order they became RUNNABLE. a
+// process is on a queue from when it becomes RUNNABLE
+// until a scheduler takes it off to run it. a queue's
+// lock comes after any p->lock.
+//
+// built with -DMLFQ (make MLFQ=1), the levels make a
+// multi-level feedback queue: a process starts at the
+// level of its nice value, moves down a level each time
+// it uses up a time slice of 2^level quanta, however many
+// sleeps that takes, and is moved back up every MLFQBOOST
+// ticks. otherwise every process stays at level 0, and
+// gives up the CPU at the end of every quantum: round robin.
+struct runq {
+  struct spinlock lock;
+  struct proc *head[NPRIO];
+  struct proc *tail[NPRIO];
+  int n[NPRIO];
+} runq[NCPU];
+
+// incremented by each priority boost.
+uint64 boostgen;
+
+// sleeping processes, hashed by the channel they sleep on,
+// oldest first. a process joins its channel's queue in
+// sleep() and leaves it when woken. a queue's lock comes
+// before any p->lock.
+struct waitq {
+  struct spinlock lock;
+  struct proc *head;
+} waitq[NWAITQ];
+
+extern struct kstat kstat;
+
 // Allocate a page for each process's kernel stack.
 // Map it high in memory, followed by an invalid
 // guard page.
@@ -51,6 +89,10 @@ procinit(void)
   
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&runq[i].lock, "runq");
+  for(int i = 0; i < NWAITQ; i++)
+    initlock(&waitq[i].lock, "waitq");
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
       p->state = UNUSED;
@@ -124,6 +166,12 @@ allocproc(void)
 found:
   p->pid = allocpid();
   p->state = USED;
+  p->faultwin = FAULTAROUND;
+  p->ucopymode = UCOPY_DEFAULT;
+  p->nice = 0;
+  p->prio = 0;
+  p->slice = 0;
+  p->boostgen = boostgen;
 
   // Allocate a trapframe page.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
@@ -159,9 +207,14 @@ freeproc(struct proc *p)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
   if(p->pagetable)
-    proc_freepagetable(p->pagetable, p->sz);
+    proc_freepagetable(p, p->pagetable, p->sz);
   p->pagetable = 0;
   p->sz = 0;
+  p->guard = 0;
+  p->asidgen = 0;
+  p->nspec = 0;
+  p->nspecused = 0;
+  memset(p->vma, 0, sizeof(p->vma));
   p->pid = 0;
   p->parent = 0;
   p->name[0] = 0;
@@ -172,7 +225,8 @@ freeproc(struct proc *p)
 }
 
 // Create a user page table for a given process, with no user memory,
-// but with trampoline and trapframe pages.
+// but with trampoline and trapframe pages, and the kernel
+// unless it has a page table of its own.
 pagetable_t
 proc_pagetable(struct proc *p)
 {
@@ -202,14 +256,26 @@ proc_pagetable(struct proc *p)
     return 0;
   }
 
+#ifndef SPLITPT
+  if(uvmmapkernel(pagetable, p) < 0){
+    uvmunmap(pagetable, TRAMPOLINE, 1, 0);
+    uvmunmap(pagetable, TRAPFRAME, 1, 0);
+    uvmfree(pagetable, 0);
+    return 0;
+  }
+#endif
+
   return pagetable;
 }
 
 // Free a process's page table, and free the
 // physical memory it refers to.
 void
-proc_freepagetable(pagetable_t pagetable, uint64 sz)
+proc_freepagetable(struct proc *p, pagetable_t pagetable, uint64 sz)
 {
+#ifndef SPLITPT
+  uvmunmapkernel(pagetable, p);
+#endif
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
   uvmunmap(pagetable, TRAPFRAME, 1, 0);
   uvmfree(pagetable, sz);
@@ -226,7 +292,7 @@ userinit(void)
   
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  setrunnable(p);
 
   release(&p->lock);
 }
@@ -241,11 +307,15 @@ growproc(int n)
 
   sz = p->sz;
   if(n > 0){
+    if(sz + n > vmabottom(p))
+      return -1;
     if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
       return -1;
     }
   } else if(n < 0){
-    sz = uvmdealloc(p->pagetable, sz, sz + n);
+    p->nspecused += uvmspecused(p->pagetable, PGROUNDUP(sz + n), sz);
+    if((sz = uvmdealloc(p->pagetable, sz, sz + n)) != p->sz + n)
+      return -1;
   }
   p->sz = sz;
   return 0;
@@ -272,6 +342,23 @@ kfork(void)
     return -1;
   }
   np->sz = p->sz;
+  np->guard = p->guard;
+
+  // and the regions set up by mmap().
+  if(vmafork(p, np) < 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+
+  // pages of the program not yet read in.
+  if(p->execip)
+    np->execip = iexecdup(p->execip);
+  memmove(np->seg, p->seg, sizeof(p->seg));
+  np->faultwin = p->faultwin;
+  np->ucopymode = p->ucopymode;
+  np->nice = p->nice;
+  np->prio = p->nice;
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -296,12 +383,100 @@ kfork(void)
   release(&wait_lock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
+  setrunnable(np);
   release(&np->lock);
 
   return pid;
 }
 
+// Create a new process running the program in path,
+// without copying the caller's memory only to throw it
+// away, as fork() followed by exec() would. The child
+// gets the caller's open files, as changed by the nact
+// actions in act. Returns the child's pid, or -1.
+int
+kspawn(char *path, char **argv, struct spawnact *act, int nact)
+{
+  int i, fd, newfd, argc, pid;
+  struct file *f;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  if((np = allocproc()) == 0)
+    return -1;
+  // exec needs to sleep. np can't run before it's
+  // RUNNABLE, so nothing else will touch it meanwhile.
+  release(&np->lock);
+
+  for(i = 0; i < NOFILE; i++)
+    if(p->ofile[i])
+      np->ofile[i] = filedup(p->ofile[i]);
+  np->cwd = idup(p->cwd);
+
+  // p still holds each file, so these closes are never
+  // the last reference.
+  for(i = 0; i < nact; i++){
+    fd = act[i].fd;
+    newfd = act[i].newfd;
+    if(fd < 0 || fd >= NOFILE || np->ofile[fd] == 0)
+      goto bad;
+    switch(act[i].op){
+    case SPAWN_DUP2:
+      if(newfd < 0 || newfd >= NOFILE)
+        goto bad;
+      f = filedup(np->ofile[fd]);
+      if(np->ofile[newfd])
+        fileclose(np->ofile[newfd]);
+      np->ofile[newfd] = f;
+      break;
+    case SPAWN_CLOSE:
+      fileclose(np->ofile[fd]);
+      np->ofile[fd] = 0;
+      break;
+    default:
+      goto bad;
+    }
+  }
+
+  np->faultwin = p->faultwin;
+  np->ucopymode = p->ucopymode;
+  np->nice = p->nice;
+  np->prio = p->nice;
+  memset(np->trapframe, 0, sizeof(*np->trapframe));
+  if((argc = kexecproc(np, path, argv)) < 0)
+    goto bad;
+  np->trapframe->a0 = argc;
+
+  pid = np->pid;
+
+  acquire(&wait_lock);
+  np->parent = p;
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  setrunnable(np);
+  release(&np->lock);
+
+  return pid;
+
+ bad:
+  for(i = 0; i < NOFILE; i++){
+    if(np->ofile[i]){
+      fileclose(np->ofile[i]);
+      np->ofile[i] = 0;
+    }
+  }
+  begin_op();
+  iput(np->cwd);
+  end_op();
+  np->cwd = 0;
+
+  acquire(&np->lock);
+  freeproc(np);
+  release(&np->lock);
+  return -1;
+}
+
 // Pass p's abandoned children to init.
 // Caller must hold wait_lock.
 void
@@ -328,6 +503,9 @@ kexit(int status)
   if(p == initproc)
     panic("init exiting");
 
+  // Unmap mmap() regions, writing back shared ones.
+  kmunmapall(p);
+
   // Close all open files.
   for(int fd = 0; fd < NOFILE; fd++){
     if(p->ofile[fd]){
@@ -339,8 +517,11 @@ kexit(int status)
 
   begin_op();
   iput(p->cwd);
+  if(p->execip)
+    iexecput(p->execip);
   end_op();
   p->cwd = 0;
+  p->execip = 0;
 
   acquire(&wait_lock);
 
@@ -368,7 +549,7 @@ int
 kwait(uint64 addr)
 {
   struct proc *pp;
-  int havekids, pid;
+  int havekids, pid, xstate;
   struct proc *p = myproc();
 
   acquire(&wait_lock);
@@ -383,14 +564,19 @@ kwait(uint64 addr)
 
         havekids = 1;
         if(pp->state == ZOMBIE){
-          // Found one.
+          // Found one. Copy out its exit status without
+          // the locks, so that copyout() can wait for the
+          // page to be swapped or read in. Only we can
+          // free pp meanwhile.
           pid = pp->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
-                                  sizeof(pp->xstate)) < 0) {
-            release(&pp->lock);
-            release(&wait_lock);
+          xstate = pp->xstate;
+          release(&pp->lock);
+          release(&wait_lock);
+          if(addr != 0 && copyout(p->pagetable, addr, (char *)&xstate,
+                                  sizeof(xstate)) < 0)
             return -1;
-          }
+          acquire(&wait_lock);
+          acquire(&pp->lock);
           freeproc(pp);
           release(&pp->lock);
           release(&wait_lock);
@@ -411,10 +597,286 @@ kwait(uint64 addr)
   }
 }
 
+#ifdef MLFQ
+// Move p back up to the level of its nice value if there
+// has been a priority boost since it was last looked at.
+// Caller holds p->lock.
+static void
+boostcheck(struct proc *p)
+{
+  uint64 gen = __atomic_load_n(&boostgen, __ATOMIC_RELAXED);
+
+  if(p->boostgen != gen){
+    p->boostgen = gen;
+    p->prio = p->nice;
+    p->slice = 0;
+  }
+}
+#endif
+
+// Wake an idle hart, if there is one, to come and take a
+// process from this hart's run queue.
+static void
+runqkick(void)
+{
+  struct cpu *c;
+
+  // pairs with the fence in runqidle(): either that hart
+  // sees our queued process, or we see that it's idle.
+  __sync_synchronize();
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    if(c != mycpu() && c->idle && __atomic_exchange_n(&c->idle, 0, __ATOMIC_ACQ_REL)){
+      ipi(c - cpus);
+      __atomic_fetch_add(&kstat.ipi, 1, __ATOMIC_RELAXED);
+      return;
+    }
+  }
+}
+
+// Mark p RUNNABLE and put it at the tail of this hart's
+// run queue for its level. If this hart is busy with
+// another process, kick an idle hart to come and run it.
+// Caller holds p->lock.
+static void
+setrunnable(struct proc *p)
+{
+  struct runq *q = &runq[cpuid()];
+  int l = 0;
+
+#ifdef MLFQ
+  boostcheck(p);
+  l = p->prio;
+#endif
+  p->state = RUNNABLE;
+  p->qtime = r_time();
+  acquire(&q->lock);
+  p->rqnext = 0;
+  if(q->tail[l])
+    q->tail[l]->rqnext = p;
+  else
+    q->head[l] = p;
+  q->tail[l] = p;
+  q->n[l]++;
+  release(&q->lock);
+  if(mycpu()->proc != 0 && mycpu()->proc != p)
+    runqkick();
+}
+
+// How many processes are on q.
+static int
+runqlen(struct runq *q)
+{
+  int l, n = 0;
+
+  for(l = 0; l < NPRIO; l++)
+    n += q->n[l];
+  return n;
+}
+
+// Take the process at the head of q's highest non-empty
+// level off it, or return 0 if q is empty.
+static struct proc *
+runqpop(struct runq *q)
+{
+  struct proc *p = 0;
+  int l;
+
+  acquire(&q->lock);
+  for(l = 0; l < NPRIO; l++){
+    if((p = q->head[l]) != 0){
+      q->head[l] = p->rqnext;
+      if(q->head[l] == 0)
+        q->tail[l] = 0;
+      q->n[l]--;
+      break;
+    }
+  }
+  release(&q->lock);
+  if(p){
+    __atomic_fetch_add(&kstat.runqpick[l], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&kstat.runqwait[l], r_time() - p->qtime, __ATOMIC_RELAXED);
+  }
+  return p;
+}
+
+// Choose a process for this hart to run: the next one on
+// its own queue, or if that's empty, one stolen from the
+// longest queue. Returns 0 if nothing is RUNNABLE.
+static struct proc *
+runqget(void)
+{
+  struct runq *q, *busiest;
+  struct proc *p;
+  int n, most;
+
+  if((p = runqpop(&runq[cpuid()])) != 0)
+    return p;
+  for(;;){
+    // the lengths may be stale, but only pick a victim.
+    busiest = 0;
+    most = 0;
+    for(q = runq; q < &runq[NCPU]; q++){
+      if((n = runqlen(q)) > most){
+        busiest = q;
+        most = n;
+      }
+    }
+    if(busiest == 0)
+      return 0;
+    if((p = runqpop(busiest)) != 0){
+      __atomic_fetch_add(&kstat.runqsteal, 1, __ATOMIC_RELAXED);
+      return p;
+    }
+  }
+}
+
+// Nothing to run: poll the run queues for a while, since
+// another hart may be about to wake something, then stop
+// until an interrupt, which may be a kick from runqkick().
+// Returns a process found meanwhile, or 0.
+static struct proc *
+runqidle(void)
+{
+  struct cpu *c = mycpu();
+  struct proc *p;
+  uint64 end;
+
+  end = r_time() + IDLEPOLL * (TIMEFREQ / 1000000);
+  while(r_time() < end)
+    if((p = runqget()) != 0)
+      return p;
+
+  // tell runqkick() we're idle, then look once more,
+  // for a process queued before it could know.
+  c->idle = 1;
+  __sync_synchronize();
+  if((p = runqget()) == 0){
+    // no clock ticks either, unless a sleeper is due.
+    timeridle();
+    asm volatile("wfi");
+  }
+  c->idle = 0;
+  return p;
+}
+
+// Move every queued process up to the level of its nice
+// value. Called every MLFQBOOST ticks by clockintr(). Each
+// process's own prio is set right when it is next picked
+// or queued.
+void
+runqboost(void)
+{
+  struct runq *q;
+  struct proc *p, *next;
+  int l, nice;
+
+  __atomic_fetch_add(&boostgen, 1, __ATOMIC_RELAXED);
+  for(q = runq; q < &runq[NCPU]; q++){
+    acquire(&q->lock);
+    // nobody is queued above their nice level, so level 0
+    // stays as it is.
+    for(l = 1; l < NPRIO; l++){
+      p = q->head[l];
+      q->head[l] = q->tail[l] = 0;
+      q->n[l] = 0;
+      for(; p; p = next){
+        next = p->rqnext;
+        // p->lock comes before ours; a stale nice value
+        // only matters until boostcheck().
+        nice = __atomic_load_n(&p->nice, __ATOMIC_RELAXED);
+        p->rqnext = 0;
+        if(q->tail[nice])
+          q->tail[nice]->rqnext = p;
+        else
+          q->head[nice] = p;
+        q->tail[nice] = p;
+        q->n[nice]++;
+      }
+    }
+    release(&q->lock);
+  }
+}
+
+// The number of processes queued at each level, for kstat().
+void
+runqlens(int *len)
+{
+  struct runq *q;
+  int l;
+
+  for(l = 0; l < NPRIO; l++)
+    len[l] = 0;
+  for(q = runq; q < &runq[NCPU]; q++)
+    for(l = 0; l < NPRIO; l++)
+      len[l] += q->n[l];
+}
+
+// The current process's quantum is over. Returns 1 if it
+// should give up the CPU: always, for
+// round robin; for MLFQ, if it has used up its time slice,
+// which moves it down a level, or if a process of a higher
+// level is waiting on this hart.
+int
+timeslice(void)
+{
+#ifdef MLFQ
+  struct proc *p = myproc();
+  struct runq *q = &runq[cpuid()];
+  int l, yield = 0;
+
+  acquire(&p->lock);
+  boostcheck(p);
+  if(++p->slice >= (1 << p->prio)){
+    if(p->prio < NPRIO-1)
+      p->prio++;
+    p->slice = 0;
+    yield = 1;
+  }
+  for(l = 0; l < p->prio; l++)
+    if(q->n[l] > 0)
+      yield = 1;
+  release(&p->lock);
+  return yield;
+#else
+  return 1;
+#endif
+}
+
+// Set the nice value of process pid, or of the current
+// process if pid is 0, to nice: the level it starts at,
+// and goes back up to when boosted. Returns the old nice
+// value, or -1.
+int
+ksetpriority(int pid, int nice)
+{
+  struct proc *p;
+  int old;
+
+  if(nice < 0 || nice >= NPRIO)
+    return -1;
+  if(pid == 0)
+    pid = myproc()->pid;
+  for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    if(p->pid == pid && p->state != UNUSED){
+      old = p->nice;
+      p->nice = nice;
+      if(p->prio < nice){
+        p->prio = nice;
+        p->slice = 0;
+      }
+      release(&p->lock);
+      return old;
+    }
+    release(&p->lock);
+  }
+  return -1;
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - choose a process to run from the run queues.
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
@@ -434,28 +896,39 @@ scheduler(void)
     intr_on();
     intr_off();
 
-    int found = 0;
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-        found = 1;
-      }
-      release(&p->lock);
-    }
-    if(found == 0) {
-      // nothing to run; stop running on this core until an interrupt.
-      asm volatile("wfi");
+    if((p = runqget()) == 0) {
+      // nothing to run; zero some pages for kalloc_zeroed(),
+      // look for identical pages to merge, then wait for
+      // something to run.
+      kzero_refill();
+      ksmscan();
+      if((p = runqidle()) == 0)
+        continue;
     }
+
+    // p may still be on its way out of sched() on the
+    // hart that queued it; its lock waits for that.
+    acquire(&p->lock);
+    if(p->state != RUNNABLE)
+      panic("scheduler");
+#ifdef MLFQ
+    boostcheck(p);
+#endif
+    // Switch to chosen process.  It is the process's job
+    // to release its lock and then reacquire it
+    // before jumping back to us.
+    p->state = RUNNING;
+    c->proc = p;
+    timerbusy();
+    swtch(&c->context, &p->context);
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    // Leave its page table, which may be freed once
+    // p->lock is released.
+    kvmuse();
+    c->proc = 0;
+    release(&p->lock);
   }
 }
 
@@ -492,7 +965,7 @@ yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  setrunnable(p);
   sched();
   release(&p->lock);
 }
@@ -528,18 +1001,50 @@ forkret(void)
   }
 
   // return to user space, mimicing usertrap()'s return.
-  prepare_return();
-  uint64 satp = MAKE_SATP(p->pagetable);
+  uint64 satp = prepare_return();
   uint64 trampoline_userret = TRAMPOLINE + (userret - trampoline);
   ((void (*)(uint64))trampoline_userret)(satp);
 }
 
+// The wait queue for chan.
+static struct waitq *
+waitqof(void *chan)
+{
+  return &waitq[((uint64)chan * 0x9e3779b97f4a7c15ULL) >> 32 & (NWAITQ - 1)];
+}
+
+// Take p off q, if it's there. Caller holds q->lock.
+static void
+waitqremove(struct waitq *q, struct proc *p)
+{
+  struct proc **pp;
+
+  for(pp = &q->head; *pp; pp = &(*pp)->wqnext){
+    if(*pp == p){
+      *pp = p->wqnext;
+      p->wqnext = 0;
+      return;
+    }
+  }
+}
+
 // Sleep on channel chan, releasing condition lock lk.
 // Re-acquires lk when awakened.
 void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct waitq *q = waitqof(chan);
+  struct proc **pp;
+
+  // Join chan's queue while still holding lk, so
+  // that a wakeup can't find the queue without us.
+  acquire(&q->lock);
+  for(pp = &q->head; *pp; pp = &(*pp)->wqnext)
+    ;
+  *pp = p;
+  p->wqnext = 0;
+  release(&q->lock);
   
   // Must acquire p->lock in order to
   // change p->state and then call sched.
@@ -559,28 +1064,66 @@ sleep(void *chan, struct spinlock *lk)
 
   // Tidy up.
   p->chan = 0;
+  release(&p->lock);
+
+  // still queued if kkill() woke us rather than wakeup().
+  acquire(&q->lock);
+  waitqremove(q, p);
+  release(&q->lock);
 
   // Reacquire original lock.
-  release(&p->lock);
   acquire(lk);
 }
 
-// Wake up all processes sleeping on channel chan.
-// Caller should hold the condition lock.
-void
-wakeup(void *chan)
+// Wake up processes sleeping on channel chan, all of them,
+// or only the one that has waited longest if one is set.
+static void
+wake(void *chan, int one)
 {
-  struct proc *p;
+  struct waitq *q = waitqof(chan);
+  struct proc *p, **pp;
+  int n = 0;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
+  acquire(&q->lock);
+  for(pp = &q->head; (p = *pp) != 0; ){
+    n++;
     if(p != myproc()){
       acquire(&p->lock);
       if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
+        *pp = p->wqnext;
+        p->wqnext = 0;
+        setrunnable(p);
+        release(&p->lock);
+        if(one)
+          break;
+        continue;
       }
       release(&p->lock);
     }
+    pp = &p->wqnext;
   }
+  release(&q->lock);
+  __atomic_fetch_add(&kstat.wakeup, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&kstat.wakescan, n, __ATOMIC_RELAXED);
+}
+
+// Wake up all processes sleeping on channel chan.
+// Caller should hold the condition lock.
+void
+wakeup(void *chan)
+{
+  wake(chan, 0);
+}
+
+// Wake up just one process sleeping on channel chan, for
+// when only one of them could make progress, such as
+// the next to get a sleeplock. Whichever it is must pass
+// the wakeup on if it doesn't use what it was woken for.
+// Caller should hold the condition lock.
+void
+wakeup_one(void *chan)
+{
+  wake(chan, 1);
 }
 
 // Kill the process with the given pid.
@@ -597,7 +1140,7 @@ kkill(int pid)
       p->killed = 1;
       if(p->state == SLEEPING){
         // Wake process from sleep().
-        p->state = RUNNABLE;
+        setrunnable(p);
       }
       release(&p->lock);
       return 0;
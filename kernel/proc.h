@@ -24,6 +24,9 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  uint64 asidgen;             // ASID generation that the TLB holds entries of
+  uint64 qend;                // r_time() when this quantum ends; 0 if idle
+  int idle;                   // In wfi; kick with ipi() if there's work.
 };
 
 extern struct cpu cpus[NCPU];
@@ -77,10 +80,39 @@ struct trapframe {
   /* 264 */ uint64 t4;
   /* 272 */ uint64 t5;
   /* 280 */ uint64 t6;
+  /* 288 */ uint64 kernel_syscall; // syscallfast()
 };
 
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// a region of user memory set up by mmap().
+struct vma {
+  uint64 addr;       // page-aligned start
+  uint64 len;        // bytes, page multiple; 0 if slot is free
+  int prot;          // PROT_*
+  int flags;         // MAP_*
+  struct file *f;    // backing file, 0 if anonymous
+  uint64 off;        // file offset of addr
+};
+
+// a loadable segment of the running program. exec
+// leaves its pages for vmfault() to read in on demand.
+struct seg {
+  uint64 va;         // page-aligned start; memsz 0 if slot is free
+  uint64 filesz;     // bytes that come from the file
+  uint64 memsz;      // bytes in memory; the rest are zero
+  uint64 off;        // file offset of va
+  int perm;          // PTE_* bits
+};
+
+// a sleeping process's wakeup, on a hart's timer queue;
+// see timer.c.
+struct timer {
+  uint64 when;                 // r_time() to wake up at
+  int pending;                 // still on the queue?
+  struct timer *next;          // next wakeup on the queue
+};
+
 // Per-process state
 struct proc {
   struct spinlock lock;
@@ -91,17 +123,42 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int nice;                    // Highest run queue level allowed
+  int prio;                    // Run queue level, 0 first
+  int slice;                   // Quanta run at prio
+  uint64 boostgen;             // boostgen when prio was last checked
+  uint64 qtime;                // r_time() when last made RUNNABLE
 
   // wait_lock must be held when using this:
   struct proc *parent;         // Parent process
 
+  // the run queue's lock must be held when using this:
+  struct proc *rqnext;         // Next RUNNABLE process on it
+
+  // the wait queue's lock must be held when using this:
+  struct proc *wqnext;         // Next process sleeping on it
+
+  // the timer queue's lock must be held when using this:
+  struct timer timer;          // for timersleep()
+
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
+  uint64 guard;                // User stack's guard page, or 0
+  int asid;                    // TLB tag for pagetable; see uvmsatp()
+  uint64 asidgen;              // generation of asid; 0 if none yet
+  int asidcpu;                 // hart that last ran on asid, or -1
   pagetable_t pagetable;       // User page table
   struct trapframe *trapframe; // data page for trampoline.S
+  int faultwin;                // Fault-around window, in pages
+  int ucopymode;               // How copyout() etc. work; UCOPY_* in vm.h
+  uint64 nspec;                // Pages mapped by fault-around
+  uint64 nspecused;            // ... that the process then used
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  struct vma vma[NVMA];        // mmap() regions
+  struct inode *execip;        // Program file
+  struct seg seg[NSEG];        // Program's segments
   char name[16];               // Process name (debugging)
 };
@@ -0,0 +1,160 @@
+// Slab allocator for small fixed-size kernel objects,
+// built on kalloc().
+//
+// A kmem_cache hands out objects of a single size, carved
+// out of whole pages (slabs) taken from kalloc(). Each slab
+// starts with a struct slab header, followed by as many
+// objects as fit; free objects are chained through their
+// first word. A slab is given back to kalloc() once none
+// of its objects are in use.
+//
+// Each hart keeps a few free objects of every cache, so
+// most allocations and frees don't take the cache's lock.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "slab.h"
+#include "defs.h"
+
+struct obj {
+  struct obj *next;
+};
+
+struct slab {
+  struct slab *next;         // next slab on cache's partial list
+  struct kmem_cache *cache;  // cache this slab belongs to
+  struct obj *free;          // free objects in this slab
+  int inuse;                 // objects not on free
+};
+
+// objects start this far into a slab page.
+#define SLABHDR ((sizeof(struct slab) + 15) & ~15)
+
+void
+kmem_cache_init(struct kmem_cache *c, char *name, uint size)
+{
+  initlock(&c->lock, name);
+  c->name = name;
+  c->size = (size + 15) & ~15;
+  c->perslab = (PGSIZE - SLABHDR) / c->size;
+  if(c->perslab < 1)
+    panic("kmem_cache_init");
+  c->partial = 0;
+  c->nslab = 0;
+  for(int i = 0; i < NCPU; i++)
+    c->cpu[i].n = 0;
+}
+
+// Take a free object from c's slabs, starting a new
+// slab if they are all full. Returns 0 if out of memory.
+// Caller holds c->lock.
+static void *
+slab_get(struct kmem_cache *c)
+{
+  struct slab *s;
+  struct obj *o;
+  int i;
+
+  s = c->partial;
+  if(s == 0){
+    if((s = (struct slab*)kalloc()) == 0)
+      return 0;
+    s->cache = c;
+    s->inuse = 0;
+    s->free = 0;
+    for(i = c->perslab - 1; i >= 0; i--){
+      o = (struct obj*)((char*)s + SLABHDR + i*c->size);
+      o->next = s->free;
+      s->free = o;
+    }
+    s->next = 0;
+    c->partial = s;
+    c->nslab++;
+  }
+
+  o = s->free;
+  s->free = o->next;
+  s->inuse++;
+  if(s->free == 0){
+    // slab is full; take it off the partial list.
+    c->partial = s->next;
+    s->next = 0;
+  }
+  return o;
+}
+
+// Return object x to its slab, and the slab to kalloc()
+// if it is now unused and isn't c's only partial slab.
+// Caller holds c->lock.
+static void
+slab_put(struct kmem_cache *c, void *x)
+{
+  struct slab *s, **pp;
+  struct obj *o;
+
+  s = (struct slab*)PGROUNDDOWN((uint64)x);
+  if(s->cache != c)
+    panic("kmem_cache_free");
+
+  if(s->free == 0){
+    // was full; it has a free object again.
+    s->next = c->partial;
+    c->partial = s;
+  }
+  o = (struct obj*)x;
+  o->next = s->free;
+  s->free = o;
+  s->inuse--;
+
+  if(s->inuse == 0 && (c->partial != s || s->next != 0)){
+    for(pp = &c->partial; *pp != s; pp = &(*pp)->next)
+      ;
+    *pp = s->next;
+    c->nslab--;
+    kfree((void*)s);
+  }
+}
+
+// Allocate one object from cache c.
+// Returns 0 if out of memory.
+void *
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  void *x;
+  int id;
+
+  push_off();
+  id = cpuid();
+  if(c->cpu[id].n == 0){
+    acquire(&c->lock);
+    while(c->cpu[id].n < SLABBATCH && (x = slab_get(c)) != 0)
+      c->cpu[id].obj[c->cpu[id].n++] = x;
+    release(&c->lock);
+  }
+  x = 0;
+  if(c->cpu[id].n > 0)
+    x = c->cpu[id].obj[--c->cpu[id].n];
+  pop_off();
+  return x;
+}
+
+// Free object x, which came from kmem_cache_alloc(c).
+void
+kmem_cache_free(struct kmem_cache *c, void *x)
+{
+  int id;
+
+  push_off();
+  id = cpuid();
+  if(c->cpu[id].n == NSLABCPU){
+    acquire(&c->lock);
+    while(c->cpu[id].n > NSLABCPU - SLABBATCH)
+      slab_put(c, c->cpu[id].obj[--c->cpu[id].n]);
+    release(&c->lock);
+  }
+  c->cpu[id].obj[c->cpu[id].n++] = x;
+  pop_off();
+}
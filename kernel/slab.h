@@ -0,0 +1,20 @@
+// Cache of small fixed-size kernel objects; see slab.c.
+
+#define NSLABCPU   8  // free objects a hart may keep per cache
+#define SLABBATCH  4  // objects moved between a hart and the slabs at once
+
+struct kmem_cache {
+  struct spinlock lock;  // protects partial and nslab
+  char *name;            // for debugging
+  uint size;             // object size, rounded up to 16 bytes
+  int perslab;           // objects that fit in one slab page
+  struct slab *partial;  // slabs with at least one free object
+  int nslab;             // slab pages in use
+
+  // per-hart stacks of free objects; only touched by
+  // their own hart, with interrupts off.
+  struct {
+    int n;
+    void *obj[NSLABCPU];
+  } cpu[NCPU];
+};
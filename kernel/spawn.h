@@ -0,0 +1,11 @@
+// spawn() file descriptor actions. They are applied in
+// order to the child's copy of the caller's descriptors,
+// before the program starts.
+#define SPAWN_DUP2  1   // make newfd refer to fd's file
+#define SPAWN_CLOSE 2   // close fd
+
+struct spawnact {
+  int op;     // SPAWN_DUP2 or SPAWN_CLOSE
+  int fd;
+  int newfd;  // SPAWN_DUP2 only
+};
@@ -6,10 +6,16 @@
 
 void main();
 void timerinit();
+void ipiinit();
+extern void mvec();
 
 // entry.S needs one stack per CPU.
 __attribute__ ((aligned (16))) char stack0[4096 * NCPU];
 
+// scratch area for mvec in kernelvec.S, one per CPU:
+// [0] saves a register, [1] is the CPU's CLINT MSIP.
+uint64 mscratch0[NCPU][2];
+
 // entry.S jumps here in machine mode on stack0.
 void
 start()
@@ -30,7 +36,7 @@ start()
   // delegate all interrupts and exceptions to supervisor mode.
   w_medeleg(0xffff);
   w_mideleg(0xffff);
-  w_sie(r_sie() | SIE_SEIE | SIE_STIE);
+  w_sie(r_sie() | SIE_SEIE | SIE_STIE | SIE_SSIE);
 
   // configure Physical Memory Protection to give supervisor mode
   // access to all of physical memory.
@@ -40,6 +46,9 @@ start()
   // ask for clock interrupts.
   timerinit();
 
+  // let other harts interrupt this one.
+  ipiinit();
+
   // keep each CPU's hartid in its tp register, for cpuid().
   int id = r_mhartid();
   w_tp(id);
@@ -60,7 +69,25 @@ timerinit()
   
   // allow supervisor to use stimecmp and time.
   w_mcounteren(r_mcounteren() | 2);
+
+  // and user programs to read time, for timing things.
+  w_scounteren(r_scounteren() | 2);
   
   // ask for the very first timer interrupt.
   w_stimecmp(r_time() + 1000000);
 }
+
+// other harts interrupt this one by setting its CLINT
+// MSIP register, in ipi(). that causes a machine-mode
+// software interrupt, which mvec passes on to supervisor
+// mode as a software interrupt.
+void
+ipiinit()
+{
+  int id = r_mhartid();
+
+  mscratch0[id][1] = DEVPA(CLINT_MSIP(id));
+  w_mscratch((uint64)mscratch0[id]);
+  w_mtvec((uint64)mvec);
+  w_mie(r_mie() | MIE_MSIE);
+}
@@ -0,0 +1,347 @@
+//
+// Swapping: when physical memory runs out, cold pages of
+// user memory are written to the swap space that mkfs
+// leaves after the file system on disk, and read back in
+// by vmfault() when they are next used. Pages that
+// compress well are kept, compressed, in memory instead;
+// see zram.c.
+//
+// A swapped-out page's PTE has PTE_V clear and PTE_SWAP
+// set, keeps the page's permission bits, and holds the
+// swap slot where the physical page number would be. Slots
+// below NSWAP are on disk, the NZRAM above them in zram.
+// fork() shares slots between page tables, so each slot
+// has a reference count.
+//
+// Pages to swap out are chosen by CLOCK: a hand sweeps over
+// each process's heap and private mmap() regions in turn,
+// clearing the accessed bits that the hardware sets, and
+// takes the pages whose bit is already clear. Only 4KB
+// pages that no other page table maps are candidates; see
+// uvmswappable().
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "fs.h"
+#include "fcntl.h"
+#include "kstat.h"
+
+extern struct proc proc[NPROC];
+extern struct superblock sb;
+extern struct kstat kstat;
+
+struct {
+  struct spinlock lock;
+  uchar ref[NSWAP+NZRAM];    // page tables using each slot
+  int next[2];               // where to look for a free slot, on disk and in zram
+
+  struct sleeplock reclaim;  // one swapreclaim() at a time
+  int hand;                  // CLOCK hand: proc[hand],
+  int region;                // 0 for its heap, i for vma[i-1],
+  uint64 va;                 // at this address.
+} swap;
+
+void
+swapinit(void)
+{
+  initlock(&swap.lock, "swap");
+  initsleeplock(&swap.reclaim, "reclaim");
+}
+
+// How many pages of swap space there are.
+int
+swapsize(void)
+{
+  return sb.nswap < NSWAP ? sb.nswap : NSWAP;
+}
+
+// Find a free swap slot, in zram if z is set and on disk
+// otherwise, and take a reference to it. Returns the slot,
+// or -1 if there are none.
+static int
+slotalloc(int z)
+{
+  int i, slot, base, n;
+
+  base = z ? NSWAP : 0;
+  n = z ? NZRAM : swapsize();
+  acquire(&swap.lock);
+  for(i = 0; i < n; i++){
+    slot = base + (swap.next[z] + i) % n;
+    if(swap.ref[slot] == 0){
+      swap.ref[slot] = 1;
+      swap.next[z] = slot - base + 1;
+      if(!z)
+        kstat.swapused++;
+      release(&swap.lock);
+      return slot;
+    }
+  }
+  release(&swap.lock);
+  return -1;
+}
+
+// Give back a slot from slotalloc() that nothing was
+// stored in after all.
+static void
+slotabort(int slot)
+{
+  acquire(&swap.lock);
+  swap.ref[slot] = 0;
+  if(slot < NSWAP)
+    kstat.swapused--;
+  release(&swap.lock);
+}
+
+// Another page table refers to slot, after fork().
+void
+swapdup(int slot)
+{
+  acquire(&swap.lock);
+  if(swap.ref[slot] == 0 || swap.ref[slot] == 255)
+    panic("swapdup");
+  swap.ref[slot]++;
+  release(&swap.lock);
+}
+
+// A page table no longer refers to slot.
+void
+swapfree(int slot)
+{
+  acquire(&swap.lock);
+  if(swap.ref[slot] == 0)
+    panic("swapfree");
+  if(--swap.ref[slot] == 0){
+    if(slot < NSWAP)
+      kstat.swapused--;
+    else
+      zramfree(slot - NSWAP);
+  }
+  release(&swap.lock);
+}
+
+static uint
+slotblock(int slot)
+{
+  return sb.swapstart + slot * PGBLOCKS;
+}
+
+// Can the caller wait for the disk? Not while holding a
+// spinlock.
+static int
+cansleep(void)
+{
+  int spin;
+
+  push_off();
+  spin = mycpu()->noff > 1;
+  pop_off();
+  return !spin;
+}
+
+// Can pages of p's be swapped out by the current process?
+// Only if p is the current process, or isn't running, so
+// that no other hart's TLB holds its PTEs.
+static int
+swappable(struct proc *p)
+{
+  return p == myproc() || p->state == RUNNABLE || p->state == SLEEPING;
+}
+
+// After changing a PTE of p's: flush it from this hart's
+// TLB if p is the current process; otherwise give p a fresh
+// ASID, with no stale TLB entries, when it next runs.
+static void
+swapflush(struct proc *p, uint64 va)
+{
+  if(p == myproc())
+    tlbflush(p->pagetable, va);
+  else
+    p->asidgen = 0;
+}
+
+// Write the page at va, whose PTE is pte, to swap, and
+// replace the mapping with its slot, unless the process
+// used the page meanwhile. Called, and returns, with
+// p->lock held, but releases it while the page is being
+// compressed or written. Returns 1 if the page was
+// swapped out.
+static int
+swapout(struct proc *p, uint64 va, pte_t *pte)
+{
+  uint64 pa;
+  void *spare;
+  int slot, pid, n;
+
+  // PTE_D tells whether the page was written while its
+  // contents were being compressed or on the way to the disk.
+  pa = PTE2PA(*pte);
+  pid = p->pid;
+  *pte &= ~PTE_D;
+  swapflush(p, va);
+  kdup((void*)pa);
+  release(&p->lock);
+
+  // keep it in zram if it compresses well enough,
+  // otherwise write it to disk.
+  n = -1;
+  if((slot = slotalloc(1)) >= 0 && (n = zramcompress((void*)pa)) < 0){
+    slotabort(slot);
+    slot = -1;
+  }
+  if(slot < 0 && (slot = slotalloc(0)) >= 0)
+    virtio_disk_rwpage(slotblock(slot), (void*)pa, 1);
+
+  acquire(&p->lock);
+  if(slot < 0 || p->pid != pid || !swappable(p) || (pte = walk(p->pagetable, va, 0)) == 0 ||
+     (*pte & (PTE_V|PTE_D)) != PTE_V || PTE2PA(*pte) != pa || krefcnt((void*)pa) != 2){
+    if(slot >= 0)
+      slotabort(slot);
+    kfree((void*)pa);
+    return 0;
+  }
+
+  // if the pool needs a page and memory is out, zramsave()
+  // takes this one, which is about to be free anyway.
+  spare = (void*)pa;
+  if(n >= 0)
+    zramsave(slot - NSWAP, n, &spare);
+  *pte = SLOT2PTE(slot) | (PTE_FLAGS(*pte) & (PTE_R|PTE_W|PTE_X|PTE_U)) | PTE_SWAP;
+  swapflush(p, va);
+  kfree((void*)pa);
+  if(spare)
+    kfree(spare);
+  __atomic_fetch_add(&kstat.swapout, 1, __ATOMIC_RELAXED);
+  if(n >= 0)
+    __atomic_fetch_add(&kstat.zramout, 1, __ATOMIC_RELAXED);
+  return 1;
+}
+
+// Move the CLOCK hand over p's memory, swapping out up to
+// n pages. Returns how many it swapped out; the hand is
+// left at the end of p's memory if that's fewer than n.
+// Caller holds p->lock.
+static int
+swapscan(struct proc *p, int n)
+{
+  uint64 start, end;
+  struct vma *v;
+  pte_t *pte;
+  int done = 0;
+
+  for(; swap.region <= NVMA; swap.region++, swap.va = 0){
+    if(swap.region == 0){
+      start = 0;
+      end = p->sz;
+    } else {
+      v = &p->vma[swap.region-1];
+      // shared pages must stay where the others can see them.
+      if(v->len == 0 || (v->flags & MAP_SHARED))
+        continue;
+      start = v->addr;
+      end = v->addr + v->len;
+    }
+    if(swap.va < start)
+      swap.va = start;
+    while(swap.va < end){
+      if(!swappable(p))
+        return done;
+      if(walk(p->pagetable, swap.va, 0) == 0){
+        // no page-table page here; skip its 2MB.
+        swap.va = swap.va - swap.va % MEGAPGSIZE + MEGAPGSIZE;
+        continue;
+      }
+      pte = uvmswappable(p->pagetable, swap.va);
+      swap.va += PGSIZE;
+      if(pte && swapout(p, swap.va - PGSIZE, pte) && ++done == n)
+        return done;
+    }
+  }
+  return done;
+}
+
+// Memory has run out: swap out up to SWAPBATCH pages of
+// user memory. Returns how many, which is 0 if swap is
+// full, or the caller can't wait for the disk.
+int
+swapreclaim(void)
+{
+  struct proc *p;
+  int i, done;
+
+  if(!cansleep())
+    return 0;
+
+  acquiresleep(&swap.reclaim);
+  done = 0;
+  // two sweeps: the first may only clear accessed bits.
+  for(i = 0; i < 2*NPROC+1 && done < SWAPBATCH; i++){
+    p = &proc[swap.hand];
+    acquire(&p->lock);
+    if(swappable(p))
+      done += swapscan(p, SWAPBATCH - done);
+    release(&p->lock);
+    if(done < SWAPBATCH){
+      // this process is done; on to the next.
+      swap.hand = (swap.hand + 1) % NPROC;
+      swap.region = 0;
+      swap.va = 0;
+    }
+  }
+  releasesleep(&swap.reclaim);
+  return done;
+}
+
+// Like kalloc(), or kalloc_zeroed() if zero is set, but if
+// memory has run out, swap pages out to make room.
+void *
+kalloc_reclaim(int zero)
+{
+  void *mem;
+
+  for(;;){
+    mem = zero ? kalloc_zeroed() : kalloc();
+    if(mem || swapreclaim() == 0)
+      return mem;
+  }
+}
+
+// Read the swapped-out page that pte refers to back in,
+// or decompress it, and map it in its place. Returns its
+// physical address, or 0 if out of memory or if the
+// caller can't wait for the disk.
+uint64
+swapin(pte_t *pte)
+{
+  char *mem;
+  int slot;
+  uint64 t;
+
+  t = r_time();
+  slot = PTE2SLOT(*pte);
+  if(slot < NSWAP && !cansleep())
+    return 0;
+  if((mem = kalloc_reclaim(0)) == 0)
+    return 0;
+  if(slot < NSWAP)
+    virtio_disk_rwpage(slotblock(slot), mem, 0);
+  else
+    zramload(slot - NSWAP, mem);
+  *pte = PA2PTE(mem) | (PTE_FLAGS(*pte) & ~PTE_SWAP) | PTE_V;
+  swapfree(slot);
+
+  t = r_time() - t;
+  __atomic_fetch_add(&kstat.swapin, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&kstat.swaptime, t, __ATOMIC_RELAXED);
+  if(slot >= NSWAP){
+    __atomic_fetch_add(&kstat.zramin, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&kstat.zramtime, t, __ATOMIC_RELAXED);
+  }
+  return (uint64)mem;
+}
@@ -102,6 +102,14 @@ extern uint64 sys_link(void);
 extern uint64 sys_mkdir(void);
 extern uint64 sys_close(void);
 extern uint64 sys_getcwd(void);
+extern uint64 sys_faultaround(void);
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
+extern uint64 sys_spawn(void);
+extern uint64 sys_kstat(void);
+extern uint64 sys_setpriority(void);
+extern uint64 sys_nsleep(void);
+extern uint64 sys_copymode(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -128,6 +136,14 @@ static uint64 (*syscalls[])(void) = {
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
 [SYS_getcwd]   sys_getcwd,
+[SYS_faultaround] sys_faultaround,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_spawn]   sys_spawn,
+[SYS_kstat]   sys_kstat,
+[SYS_setpriority] sys_setpriority,
+[SYS_nsleep]  sys_nsleep,
+[SYS_copymode] sys_copymode,
 };
 
 void
@@ -147,3 +163,21 @@ syscall(void)
     p->trapframe->a0 = -1;
   }
 }
+
+// trampoline.S calls this, instead of usertrap(), for the
+// system calls in FASTSYSCALLS: ones that are quick and
+// can neither sleep nor fault. uservec saved only the
+// registers that C code may change, and left interrupts
+// off and stvec pointing at itself, so nothing here may
+// trap. A kill or a timer tick waits for the next trap.
+// Returns the user satp, to userretfast in trampoline.S.
+uint64
+syscallfast(void)
+{
+  struct proc *p = myproc();
+
+  p->trapframe->epc = r_sepc() + 4;
+  w_sepc(p->trapframe->epc);
+  p->trapframe->a0 = syscalls[p->trapframe->a7]();
+  return uvmsatp(p);
+}
@@ -21,3 +21,15 @@
 #define SYS_mkdir  20
 #define SYS_close  21
 #define SYS_getcwd  22
+#define SYS_faultaround 23
+#define SYS_mmap   24
+#define SYS_munmap 25
+#define SYS_spawn  26
+#define SYS_kstat  27
+#define SYS_setpriority 28
+#define SYS_nsleep 29
+#define SYS_copymode 30
+
+// system calls that trampoline.S hands to syscallfast(),
+// as a mask of their numbers, which must be below 32.
+#define FASTSYSCALLS ((1 << SYS_getpid) | (1 << SYS_uptime))
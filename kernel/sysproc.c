@@ -6,6 +6,7 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "vm.h"
+#include "kstat.h"
 
 uint64
 sys_exit(void)
@@ -55,7 +56,7 @@ sys_sbrk(void)
     // Lazily allocate memory for this process: increase its memory
     // size but don't allocate memory. If the processes uses the
     // memory, vmfault() will allocate it.
-    if(addr + n < addr)
+    if(addr + n < addr || addr + n > vmabottom(myproc()))
       return -1;
     myproc()->sz += n;
   }
@@ -66,22 +67,27 @@ uint64
 sys_pause(void)
 {
   int n;
-  uint ticks0;
 
   argint(0, &n);
   if(n < 0)
     n = 0;
-  acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(killed(myproc())){
-      release(&tickslock);
-      return -1;
-    }
-    sleep(&ticks, &tickslock);
-  }
-  release(&tickslock);
-  return 0;
+  return timersleep(r_time() + (uint64)n * (TIMEFREQ / TICKHZ));
+}
+
+// sleep for n nanoseconds, to the nearest tick of the
+// time counter.
+uint64
+sys_nsleep(void)
+{
+  uint64 n, now, q = 1000000000 / TIMEFREQ;
+
+  argaddr(0, &n);
+  now = r_time();
+  // round up, without wrapping for n near 2^64.
+  n = n / q + (n % q != 0);
+  if(n > ~0UL - now)
+    n = ~0UL - now;
+  return timersleep(now + n);
 }
 
 uint64
@@ -93,15 +99,92 @@ sys_kill(void)
   return kkill(pid);
 }
 
-// return how many clock tick interrupts have occurred
-// since start.
+// return how many clock ticks have gone by since start,
+// whether or not any hart took an interrupt for them.
 uint64
 sys_uptime(void)
 {
-  uint xticks;
+  return r_time() / (TIMEFREQ / TICKHZ);
+}
+
+// copy the system-wide counters out to the user.
+uint64
+sys_kstat(void)
+{
+  extern struct kstat kstat;
+  struct kstat st;
+  uint64 addr;
+
+  argaddr(0, &addr);
+  st = kstat;
+  st.asidgen = uvmasidgen();
+  st.swapsize = swapsize();
+  st.ksmsaved = ksmsaved();
+  runqlens(st.runqlen);
+  return copyout(myproc()->pagetable, addr, (char*)&st, sizeof(st));
+}
+
+// set the fault-around window to n pages, unless n is
+// negative, and copy the process's fault-around statistics
+// to st if it isn't 0. returns the old window.
+uint64
+sys_faultaround(void)
+{
+  int n, old;
+  uint64 addr;
+  struct vmstat st;
+  struct proc *p = myproc();
+
+  argint(0, &n);
+  argaddr(1, &addr);
+  if(n > MAXFAULTAROUND)
+    return -1;
+
+  old = p->faultwin;
+  if(n >= 0)
+    p->faultwin = n;
+  if(addr != 0){
+    p->nspecused += uvmspecused(p->pagetable, 0, p->sz);
+    st.faultwin = p->faultwin;
+    st.nspec = p->nspec;
+    st.nspecused = p->nspecused;
+    if(copyout(p->pagetable, addr, (char*)&st, sizeof(st)) < 0)
+      return -1;
+  }
+  return old;
+}
+
+// set the nice value of a process, 0 for the caller.
+// returns the old value, or -1.
+uint64
+sys_setpriority(void)
+{
+  int pid, nice;
+
+  argint(0, &pid);
+  argint(1, &nice);
+  return ksetpriority(pid, nice);
+}
+
+// choose how the kernel copies to and from this process's
+// memory, one of UCOPY_* in vm.h, unless mode is negative.
+// returns the old mode, or -1.
+uint64
+sys_copymode(void)
+{
+  int mode, old;
+  struct proc *p = myproc();
+
+  argint(0, &mode);
+  if(mode > UCOPY_SUM)
+    return -1;
+#ifdef SPLITPT
+  if(mode == UCOPY_SUM)
+    return -1;
+#endif
 
-  acquire(&tickslock);
-  xticks = ticks;
-  release(&tickslock);
-  return xticks;
+  old = p->ucopymode;
+  if(mode >= 0)
+    p->ucopymode = mode;
+  return old;
 }
@@ -0,0 +1,174 @@
+//
+// Timers: each hart keeps a queue of sleeping processes'
+// wakeups, earliest first, and programs stimecmp for
+// whichever comes first of the earliest wakeup and, if
+// it's running a process, the end of its quantum. So a
+// sleep can be as short as the time counter allows, and
+// an idle hart with nothing to wake gets no clock
+// interrupts at all.
+//
+// A process sleeping until some time puts its own timer
+// on the queue of the hart it's on, and sleeps on it.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "kstat.h"
+
+extern struct kstat kstat;
+
+#define QUANTUMLEN ((uint64)QUANTUM * (TIMEFREQ / 1000))
+
+struct timerq {
+  struct spinlock lock;
+  struct timer *head;
+} timerq[NCPU];
+
+void
+timerqinit(void)
+{
+  struct timerq *q;
+
+  for(q = timerq; q < &timerq[NCPU]; q++)
+    initlock(&q->lock, "timerq");
+}
+
+// Ask for the next clock interrupt on this hart, which
+// q belongs to. This also clears the interrupt request.
+// Caller holds q->lock.
+static void
+timerarm(struct timerq *q)
+{
+  struct cpu *c = mycpu();
+  uint64 next = ~0UL;
+
+  if(c->qend)
+    next = c->qend;
+  if(q->head && q->head->when < next)
+    next = q->head->when;
+  w_stimecmp(next);
+}
+
+// Take t off q, if it's still there. Caller holds q->lock.
+static void
+timerremove(struct timerq *q, struct timer *t)
+{
+  struct timer **pp;
+
+  for(pp = &q->head; *pp; pp = &(*pp)->next){
+    if(*pp == t){
+      *pp = t->next;
+      break;
+    }
+  }
+  t->pending = 0;
+}
+
+// A clock interrupt: wake the processes whose time has
+// come, and note whether the running process's quantum
+// is over. Returns 1 if it is.
+int
+timerintr(void)
+{
+  struct cpu *c = mycpu();
+  struct timerq *q = &timerq[cpuid()];
+  struct timer *t;
+  uint64 now = r_time();
+  int over = 0;
+
+  __atomic_fetch_add(&kstat.clockintr, 1, __ATOMIC_RELAXED);
+  if(c->qend && now >= c->qend){
+    c->qend = now + QUANTUMLEN;
+    over = 1;
+  }
+  acquire(&q->lock);
+  while((t = q->head) != 0 && t->when <= now){
+    q->head = t->next;
+    t->pending = 0;
+    wakeup(t);
+    __atomic_fetch_add(&kstat.timerwake, 1, __ATOMIC_RELAXED);
+  }
+  timerarm(q);
+  release(&q->lock);
+  return over;
+}
+
+// This hart is about to run a process. Start a quantum if
+// it was idle, and make sure the quantum's end will
+// interrupt it. Called by scheduler() with interrupts off.
+void
+timerbusy(void)
+{
+  struct cpu *c = mycpu();
+  struct timerq *q = &timerq[cpuid()];
+  uint64 now = r_time();
+
+  if(c->qend > now)
+    return;
+  c->qend = now + QUANTUMLEN;
+  acquire(&q->lock);
+  timerarm(q);
+  release(&q->lock);
+}
+
+// This hart has nothing to run: ask for a clock interrupt
+// only when a sleeper is due, if one ever is. Called by
+// scheduler() with interrupts off.
+void
+timeridle(void)
+{
+  struct cpu *c = mycpu();
+  struct timerq *q = &timerq[cpuid()];
+
+  c->qend = 0;
+  acquire(&q->lock);
+  timerarm(q);
+  release(&q->lock);
+}
+
+// Sleep until r_time() reaches when. Returns 0, or -1 if
+// the process was killed first.
+int
+timersleep(uint64 when)
+{
+  struct proc *p = myproc();
+  struct timer *t = &p->timer, **pp;
+  struct timerq *q;
+  int r = 0;
+
+  if(when <= r_time())
+    return 0;
+
+  // the queue of the hart we're on, which is the only one
+  // that can program its stimecmp. once asleep, we may be
+  // woken and run on another.
+  push_off();
+  q = &timerq[cpuid()];
+  acquire(&q->lock);
+  pop_off();
+
+  t->when = when;
+  t->pending = 1;
+  for(pp = &q->head; *pp && (*pp)->when <= when; pp = &(*pp)->next)
+    ;
+  t->next = *pp;
+  *pp = t;
+  if(q->head == t)
+    timerarm(q);
+
+  while(t->pending){
+    if(killed(p)){
+      timerremove(q, t);
+      r = -1;
+      break;
+    }
+    sleep(t, &q->lock);
+  }
+  release(&q->lock);
+  return r;
+}
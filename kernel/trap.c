@@ -68,9 +68,9 @@ usertrap(void)
     syscall();
   } else if((which_dev = devintr()) != 0){
     // ok
-  } else if((r_scause() == 15 || r_scause() == 13) &&
-            vmfault(p->pagetable, r_stval(), (r_scause() == 13)? 1 : 0) != 0) {
-    // page fault on lazily-allocated page
+  } else if((r_scause() == 15 || r_scause() == 13 || r_scause() == 12) &&
+            vmfault(p->pagetable, r_stval(), (r_scause() == 15)? 0 : 1) != 0) {
+    // page fault on lazily-allocated or demand-paged page
   } else {
     printf("usertrap(): unexpected scause 0x%lx pid=%d\n", r_scause(), p->pid);
     printf("            sepc=0x%lx stval=0x%lx\n", r_sepc(), r_stval());
@@ -80,23 +80,22 @@ usertrap(void)
   if(killed(p))
     kexit(-1);
 
-  // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2)
+  // give up the CPU if this is the end of a quantum.
+  if(which_dev == 2 && timeslice())
     yield();
 
-  prepare_return();
-
   // the user page table to switch to, for trampoline.S
-  uint64 satp = MAKE_SATP(p->pagetable);
+  uint64 satp = prepare_return();
 
   // return to trampoline.S; satp value in a0.
   return satp;
 }
 
 //
-// set up trapframe and control registers for a return to user space
+// set up trapframe and control registers for a return to user space.
+// returns the satp value for the user page table.
 //
-void
+uint64
 prepare_return(void)
 {
   struct proc *p = myproc();
@@ -112,9 +111,10 @@ prepare_return(void)
 
   // set up trapframe values that uservec will need when
   // the process next traps into the kernel.
-  p->trapframe->kernel_satp = r_satp();         // kernel page table
+  p->trapframe->kernel_satp = kvmsatp();        // kernel page table
   p->trapframe->kernel_sp = p->kstack + PGSIZE; // process's kernel stack
   p->trapframe->kernel_trap = (uint64)usertrap;
+  p->trapframe->kernel_syscall = (uint64)syscallfast;
   p->trapframe->kernel_hartid = r_tp();         // hartid for cpuid()
 
   // set up the registers that trampoline.S's sret will use
@@ -128,6 +128,30 @@ prepare_return(void)
 
   // set S Exception Program Counter to the saved user pc.
   w_sepc(p->trapframe->epc);
+
+  return uvmsatp(p);
+}
+
+// kernel code that may fault on a user address, and where
+// to go instead if the address turns out to be bad.
+extern char ucopy_start[], ucopy_end[], ucopy_fault[];  // ucopy.S
+static struct {
+  char *start, *end;  // the code: [start, end)
+  char *fixup;
+} extable[] = {
+  { ucopy_start, ucopy_end, ucopy_fault },
+};
+
+// the fixup address for a fault at pc, or 0.
+static uint64
+exfixup(uint64 pc)
+{
+  int i;
+
+  for(i = 0; i < NELEM(extable); i++)
+    if(pc >= (uint64)extable[i].start && pc < (uint64)extable[i].end)
+      return (uint64)extable[i].fixup;
+  return 0;
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -139,48 +163,81 @@ kerneltrap()
   uint64 sepc = r_sepc();
   uint64 sstatus = r_sstatus();
   uint64 scause = r_scause();
+  uint64 stval = r_stval();
+  uint64 fixup;
   
   if((sstatus & SSTATUS_SPP) == 0)
     panic("kerneltrap: not from supervisor mode");
   if(intr_get() != 0)
     panic("kerneltrap: interrupts enabled");
 
-  if((which_dev = devintr()) == 0){
+  // ucopy.S may have been using user memory; nothing this
+  // trap runs, or yield()s to, should.
+  w_sstatus(sstatus & ~SSTATUS_SUM);
+
+  if((scause == 13 || scause == 15) && (fixup = exfixup(sepc)) != 0){
+    // a page fault on a user address; map the page and
+    // retry, or give up at the fixup. vmfault() may have
+    // to read the disk, so allow interrupts if the copy did.
+    if(sstatus & SSTATUS_SPIE)
+      intr_on();
+    if(ucopyfault(stval, scause == 15) == 0)
+      sepc = fixup;
+    intr_off();
+  } else if((which_dev = devintr()) == 0){
     // interrupt or trap from an unknown source
     printf("scause=0x%lx sepc=0x%lx stval=0x%lx\n", scause, r_sepc(), r_stval());
     panic("kerneltrap");
   }
 
-  // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2 && myproc() != 0)
+  // give up the CPU if this is the end of a quantum.
+  if(which_dev == 2 && myproc() != 0 && timeslice())
     yield();
 
+#ifndef SPLITPT
+  // the yield(), or a sleep in ucopyfault(), leaves this hart
+  // on the kernel's page table, and ucopy.S needs p's back.
+  struct proc *p = myproc();
+  if(p != 0 && exfixup(sepc) &&
+     (r_satp() & ((1L << SATP_ASIDSHIFT) - 1)) != (uint64)p->pagetable >> 12)
+    uvmsatp(p);
+#endif
+
   // the yield() may have caused some traps to occur,
   // so restore trap registers for use by kernelvec.S's sepc instruction.
   w_sepc(sepc);
   w_sstatus(sstatus);
 }
 
-void
+// returns 1 if the running process's quantum is over.
+int
 clockintr()
 {
-  if(cpuid() == 0){
+  uint t = r_time() / (TIMEFREQ / TICKHZ);
+  uint t0;
+
+  // ticks follow the time counter, brought up to date
+  // by whichever harts are taking clock interrupts.
+  if(t != ticks){
     acquire(&tickslock);
-    ticks++;
-    wakeup(&ticks);
+    t0 = ticks;
+    if(t > t0)
+      ticks = t;
     release(&tickslock);
+#ifdef MLFQ
+    if(t > t0 && t / MLFQBOOST != t0 / MLFQBOOST)
+      runqboost();
+#endif
   }
 
-  // ask for the next timer interrupt. this also clears
-  // the interrupt request. 1000000 is about a tenth
-  // of a second.
-  w_stimecmp(r_time() + 1000000);
+  // wake sleepers, and ask for the next timer interrupt.
+  return timerintr();
 }
 
 // check if it's an external interrupt or software interrupt,
 // and handle it.
-// returns 2 if timer interrupt,
-// 1 if other device,
+// returns 2 if timer interrupt that ends the quantum,
+// 1 if other device or timer,
 // 0 if not recognized.
 int
 devintr()
@@ -210,10 +267,22 @@ devintr()
     return 1;
   } else if(scause == 0x8000000000000005L){
     // timer interrupt.
-    clockintr();
-    return 2;
+    return clockintr() ? 2 : 1;
+  } else if(scause == 0x8000000000000001L){
+    // software interrupt from another hart's ipi(),
+    // which has done its job by getting us out of wfi.
+    w_sip(r_sip() & ~2);
+    return 1;
   } else {
     return 0;
   }
 }
 
+
+// interrupt hart, e.g. to wake it from wfi. see mvec in
+// kernelvec.S for how it gets there.
+void
+ipi(int hart)
+{
+  *(volatile uint32 *)CLINT_MSIP(hart) = 1;
+}
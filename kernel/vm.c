@@ -7,6 +7,9 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "fs.h"
+#include "fcntl.h"
+#include "kstat.h"
+#include "vm.h"
 
 /*
  * the kernel's page table.
@@ -17,23 +20,46 @@ extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+// mapped read-only into user address spaces wherever a
+// process has read, but not yet written, lazily-allocated
+// memory. never freed, and not reference counted.
+static char zeropage[PGSIZE] __attribute__((aligned(PGSIZE)));
+
+struct kstat kstat;
+
+// hardware address-space identifiers. each TLB entry is
+// tagged with the ASID in satp when it was made, so that
+// switching page tables needn't flush the TLB. the kernel
+// page table uses ASID 0. a user page table gets an ASID
+// of its own when it first runs; when they run out, a new
+// generation starts, and each hart flushes its whole TLB
+// before it uses an ASID of the new generation.
+struct {
+  struct spinlock lock;
+  uint64 gen;   // current generation, from 1
+  int next;     // next ASID to hand out in gen
+  int max;      // largest ASID, or 0 if the hardware has none
+} asids;
+
 // Make a direct-map page table for the kernel.
 pagetable_t
 kvmmake(void)
 {
   pagetable_t kpgtbl;
 
-  kpgtbl = (pagetable_t) kalloc();
-  memset(kpgtbl, 0, PGSIZE);
+  kpgtbl = (pagetable_t) kalloc_zeroed();
 
   // uart registers
-  kvmmap(kpgtbl, UART0, UART0, PGSIZE, PTE_R | PTE_W);
+  kvmmap(kpgtbl, UART0, DEVPA(UART0), PGSIZE, PTE_R | PTE_W);
+
+  // CLINT, for ipi()
+  kvmmap(kpgtbl, CLINT, DEVPA(CLINT), PGSIZE, PTE_R | PTE_W);
 
   // virtio mmio disk interface
-  kvmmap(kpgtbl, VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
+  kvmmap(kpgtbl, VIRTIO0, DEVPA(VIRTIO0), PGSIZE, PTE_R | PTE_W);
 
   // PLIC
-  kvmmap(kpgtbl, PLIC, PLIC, 0x4000000, PTE_R | PTE_W);
+  kvmmap(kpgtbl, PLIC, DEVPA(PLIC), 0x4000000, PTE_R | PTE_W);
 
   // map kernel text executable and read-only.
   kvmmap(kpgtbl, KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X);
@@ -66,6 +92,9 @@ void
 kvminit(void)
 {
   kernel_pagetable = kvmmake();
+  initlock(&asids.lock, "asids");
+  asids.gen = 1;
+  asids.next = 1;
 }
 
 // Switch the current CPU's h/w page table register to
@@ -78,13 +107,219 @@ kvminithart()
 
   w_satp(MAKE_SATP(kernel_pagetable));
 
+  if(cpuid() == 0){
+    // how many ASIDs? the bits that don't exist read as zero.
+    w_satp(MAKE_SATP(kernel_pagetable) | SATP_ASID(SATP_ASIDMASK));
+    asids.max = (r_satp() >> SATP_ASIDSHIFT) & SATP_ASIDMASK;
+    w_satp(MAKE_SATP(kernel_pagetable));
+    if(asids.max == ASIDNONE)
+      asids.max--;
+    kstat.nasid = asids.max;
+  }
+
   // flush stale entries from the TLB.
   sfence_vma();
 }
 
+// The satp value for the kernel page table, for trampoline.S
+// to switch to when p next traps into the kernel, or 0 to
+// stay on p's page table.
+uint64
+kvmsatp(void)
+{
+#ifdef SPLITPT
+  if(asids.max == 0)
+    return MAKE_SATP(kernel_pagetable) | SATP_ASID(ASIDNONE);
+  return MAKE_SATP(kernel_pagetable);
+#else
+  return 0;
+#endif
+}
+
+// Switch this hart to the kernel page table, if it's on a
+// user one, which may be about to be freed. Any stale user
+// entries left in the TLB are flushed before the hart next
+// switches to a user page table.
+void
+kvmuse(void)
+{
+  uint64 satp = MAKE_SATP(kernel_pagetable);
+
+  if(r_satp() != satp)
+    w_satp(satp);
+}
+
+#ifndef SPLITPT
+// Map the kernel into p's new page table: the gigabyte at
+// KERNBASE, whose level-1 page table is the kernel's own,
+// and p's kernel stack. Returns 0, or -1 if out of memory.
+int
+uvmmapkernel(pagetable_t pagetable, struct proc *p)
+{
+  pte_t *pte;
+
+  pagetable[PX(2, KERNBASE)] = kernel_pagetable[PX(2, KERNBASE)];
+  if((pte = walk(kernel_pagetable, p->kstack, 0)) == 0)
+    panic("uvmmapkernel");
+  if(mappages(pagetable, p->kstack, PGSIZE, PTE2PA(*pte), PTE_R | PTE_W) != 0){
+    pagetable[PX(2, KERNBASE)] = 0;
+    return -1;
+  }
+  return 0;
+}
+
+// Undo uvmmapkernel(), before freeing the page table.
+void
+uvmunmapkernel(pagetable_t pagetable, struct proc *p)
+{
+  uvmunmap(pagetable, p->kstack, 1, 0);
+  pagetable[PX(2, KERNBASE)] = 0;
+}
+#endif
+
+// The satp value for running p's page table on this hart.
+// Gives p an ASID if it has none from the current
+// generation, and flushes whatever this hart's TLB may hold
+// that p mustn't see. Called by prepare_return(),
+// syscallfast() and kerneltrap() with interrupts off.
+uint64
+uvmsatp(struct proc *p)
+{
+  struct cpu *c = mycpu();
+  int id = cpuid();
+  uint64 satp;
+
+  __atomic_fetch_add(&kstat.uret, 1, __ATOMIC_RELAXED);
+  if(asids.max == 0){
+#ifdef SPLITPT
+    // trampoline.S will flush the TLB, twice each way.
+    __atomic_fetch_add(&kstat.tlbflush, 4, __ATOMIC_RELAXED);
+    return MAKE_SATP(p->pagetable) | SATP_ASID(ASIDNONE);
+#else
+    satp = MAKE_SATP(p->pagetable);
+    if(r_satp() != satp){
+      w_satp(satp);
+      sfence_vma();
+      __atomic_fetch_add(&kstat.tlbflush, 1, __ATOMIC_RELAXED);
+    }
+    return satp;
+#endif
+  }
+
+  if(p->asidgen != __atomic_load_n(&asids.gen, __ATOMIC_ACQUIRE)){
+    acquire(&asids.lock);
+    if(asids.next > asids.max){
+      asids.gen++;
+      asids.next = 1;
+    }
+    p->asid = asids.next++;
+    p->asidgen = asids.gen;
+    p->asidcpu = -1;
+    release(&asids.lock);
+  }
+
+  if(c->asidgen != p->asidgen){
+    // the TLB may hold entries of any ASID of another
+    // generation, which now mean other page tables.
+    sfence_vma();
+    __atomic_fetch_add(&kstat.tlbflush, 1, __ATOMIC_RELAXED);
+    c->asidgen = p->asidgen;
+    p->asidcpu = id;
+  } else if(p->asidcpu != id){
+    // entries left from when p last ran here may be stale,
+    // since only the hart it was running on flushes when
+    // its page table changes (see tlbflush()). for a new
+    // ASID, this makes the page table's PTEs visible.
+    sfence_vma_asid(p->asid);
+    __atomic_fetch_add(&kstat.tlbflushasid, 1, __ATOMIC_RELAXED);
+    p->asidcpu = id;
+  }
+  satp = MAKE_SATP(p->pagetable) | SATP_ASID(p->asid);
+#ifndef SPLITPT
+  // the kernel runs on p's page table, so switch to it
+  // here; trampoline.S sees that satp is already set.
+  if(r_satp() != satp)
+    w_satp(satp);
+#endif
+  return satp;
+}
+
+// The current ASID generation, for kstat().
+uint64
+uvmasidgen(void)
+{
+  return __atomic_load_n(&asids.gen, __ATOMIC_RELAXED);
+}
+
+// The mappings of pagetable at va, or all of them if va
+// is MAXVA, have changed. If it's the running process's,
+// flush them from this hart's TLB; any other hart flushes
+// them before the process next runs there. The page table
+// of a process that isn't running is either about to get a
+// fresh ASID, or isn't changed.
+void
+tlbflush(pagetable_t pagetable, uint64 va)
+{
+  struct proc *p = myproc();
+  int asid = 0;
+
+  if(p == 0 || p->pagetable != pagetable)
+    return;
+#ifdef SPLITPT
+  if(asids.max == 0)
+    return;  // trampoline.S flushes on the way out
+#endif
+  if(asids.max > 0){
+    if(p->asidgen == 0)
+      return;
+    asid = p->asid;
+  }
+  if(va == MAXVA){
+    sfence_vma_asid(asid);
+    __atomic_fetch_add(&kstat.tlbflushasid, 1, __ATOMIC_RELAXED);
+  } else {
+    sfence_vma_page(va, asid);
+    __atomic_fetch_add(&kstat.tlbflushpage, 1, __ATOMIC_RELAXED);
+  }
+}
+
+// a PTE that maps memory, rather than a lower-level page table.
+#define PTE_LEAF(pte) (((pte) & PTE_V) && ((pte) & (PTE_R|PTE_W|PTE_X)))
+
+// Like walk(), but stop at the level-`to` PTE: 0 for a 4KB
+// page, 1 for a megapage. If level is non-zero, set *level
+// to the level of the returned PTE, which is above `to`
+// if va lies in a megapage.
+static pte_t *
+walklevel(pagetable_t pagetable, uint64 va, int alloc, int to, int *level)
+{
+  int l;
+
+  if(va >= MAXVA)
+    panic("walk");
+
+  for(l = 2; l > to; l--) {
+    pte_t *pte = &pagetable[PX(l, va)];
+    if(PTE_LEAF(*pte))
+      break;
+    if(*pte & PTE_V) {
+      pagetable = (pagetable_t)PTE2PA(*pte);
+    } else {
+      if(!alloc || (pagetable = (pde_t*)kalloc_zeroed()) == 0)
+        return 0;
+      *pte = PA2PTE(pagetable) | PTE_V;
+    }
+  }
+  if(level)
+    *level = l;
+  return &pagetable[PX(l, va)];
+}
+
 // Return the address of the PTE in page table pagetable
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page-table pages.
+// If va lies in a 2MB megapage, returns the level-1
+// PTE that maps the whole megapage.
 //
 // The risc-v Sv39 scheme has three levels of page-table
 // pages. A page-table page contains 512 64-bit PTEs.
@@ -97,21 +332,39 @@ kvminithart()
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
 {
-  if(va >= MAXVA)
-    panic("walk");
+  return walklevel(pagetable, va, alloc, 0, 0);
+}
 
-  for(int level = 2; level > 0; level--) {
-    pte_t *pte = &pagetable[PX(level, va)];
-    if(*pte & PTE_V) {
-      pagetable = (pagetable_t)PTE2PA(*pte);
-    } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
-        return 0;
-      memset(pagetable, 0, PGSIZE);
-      *pte = PA2PTE(pagetable) | PTE_V;
-    }
-  }
-  return &pagetable[PX(0, va)];
+// The number of pages from va to end, or to the end of
+// the 2MB that one page-table page maps, whichever is
+// first. walk() returns the first of that many PTEs in a
+// row, so a caller can fill or clear them all without
+// walking again.
+static uint64
+leafrun(uint64 va, uint64 end)
+{
+  uint64 top = va - va % MEGAPGSIZE + MEGAPGSIZE;
+
+  return ((end < top ? end : top) - va) / PGSIZE;
+}
+
+// Replace the megapage PTE *pte with a page-table page of
+// 512 PTEs that map the same memory, 4KB at a time, with
+// the same permissions. Returns -1 if out of memory.
+static int
+splitmega(pte_t *pte)
+{
+  pagetable_t pagetable;
+  uint64 pa;
+  int i;
+
+  if((pagetable = (pagetable_t)kalloc()) == 0)
+    return -1;
+  pa = PTE2PA(*pte);
+  for(i = 0; i < 512; i++)
+    pagetable[i] = PA2PTE(pa + i*PGSIZE) | PTE_FLAGS(*pte);
+  *pte = PA2PTE(pagetable) | PTE_V;
+  return 0;
 }
 
 // Look up a virtual address, return the physical address,
@@ -122,11 +375,12 @@ walkaddr(pagetable_t pagetable, uint64 va)
 {
   pte_t *pte;
   uint64 pa;
+  int level;
 
   if(va >= MAXVA)
     return 0;
 
-  pte = walk(pagetable, va, 0);
+  pte = walklevel(pagetable, va, 0, 0, &level);
   if(pte == 0)
     return 0;
   if((*pte & PTE_V) == 0)
@@ -134,18 +388,23 @@ walkaddr(pagetable_t pagetable, uint64 va)
   if((*pte & PTE_U) == 0)
     return 0;
   pa = PTE2PA(*pte);
+  if(level == 1)
+    pa += PGROUNDDOWN(va) % MEGAPGSIZE;
   return pa;
 }
 
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa.
 // va and size MUST be page-aligned.
+// Uses a single megapage PTE for each 2MB-aligned stretch,
+// unless 4KB PTEs already exist there, and otherwise
+// walks once per page-table page, not once per page.
 // Returns 0 on success, -1 if walk() couldn't
 // allocate a needed page-table page.
 int
 mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 {
-  uint64 a, last;
+  uint64 a, end, n;
   pte_t *pte;
 
   if((va % PGSIZE) != 0)
@@ -158,17 +417,30 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
     panic("mappages: size");
   
   a = va;
-  last = va + size - PGSIZE;
-  for(;;){
+  end = va + size;
+  while(a < end){
+    if((a % MEGAPGSIZE) == 0 && (pa % MEGAPGSIZE) == 0 &&
+       end - a >= MEGAPGSIZE){
+      if((pte = walklevel(pagetable, a, 1, 1, 0)) == 0)
+        return -1;
+      if((*pte & PTE_V) == 0 || PTE_LEAF(*pte)){
+        if(*pte & PTE_V)
+          panic("mappages: remap");
+        *pte = PA2PTE(pa) | perm | PTE_V;
+        a += MEGAPGSIZE;
+        pa += MEGAPGSIZE;
+        continue;
+      }
+    }
     if((pte = walk(pagetable, a, 1)) == 0)
       return -1;
-    if(*pte & PTE_V)
-      panic("mappages: remap");
-    *pte = PA2PTE(pa) | perm | PTE_V;
-    if(a == last)
-      break;
-    a += PGSIZE;
-    pa += PGSIZE;
+    for(n = leafrun(a, end); n > 0; n--, pte++){
+      if(*pte & PTE_V)
+        panic("mappages: remap");
+      *pte = PA2PTE(pa) | perm | PTE_V;
+      a += PGSIZE;
+      pa += PGSIZE;
+    }
   }
   return 0;
 }
@@ -179,77 +451,167 @@ pagetable_t
 uvmcreate()
 {
   pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
+  pagetable = (pagetable_t) kalloc_zeroed();
   if(pagetable == 0)
     return 0;
-  memset(pagetable, 0, PGSIZE);
   return pagetable;
 }
 
-// Remove npages of mappings starting from va. va must be
-// page-aligned. It's OK if the mappings don't exist.
-// Optionally free the physical memory.
-void
-uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
+// physical pages waiting to be handed back to kalloc.c
+// together, in one kfree_n() call.
+struct pgbatch {
+  int n;
+  void *pa[KCACHEBATCH];
+};
+
+static void
+pgbatch_flush(struct pgbatch *b)
 {
-  uint64 a;
-  pte_t *pte;
+  kfree_n(b->pa, b->n);
+  b->n = 0;
+}
+
+static void
+pgbatch_add(struct pgbatch *b, void *pa)
+{
+  b->pa[b->n++] = pa;
+  if(b->n == NELEM(b->pa))
+    pgbatch_flush(b);
+}
+
+// Clear the PTEs of npages starting at va, one page-table
+// page at a time, adding the pages they mapped to b if b
+// isn't 0. A page-table page whose every PTE is cleared
+// is freed too.
+static void
+unmaprange(pagetable_t pagetable, uint64 va, uint64 npages, struct pgbatch *b)
+{
+  uint64 a, end, n;
+  pte_t *pte, *pde;
+  int i, level;
 
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
 
-  for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    if((pte = walk(pagetable, a, 0)) == 0) // leaf page table entry allocated?
+  end = va + npages*PGSIZE;
+  for(a = va; a < end; a += n*PGSIZE){
+    n = leafrun(a, end);
+    if((pte = walklevel(pagetable, a, 0, 0, &level)) == 0) // leaf page table allocated?
       continue;   
-    if((*pte & PTE_V) == 0)  // has physical page been allocated?
+    if(level == 1){
+      // a megapage; callers split any that they unmap in part.
+      if(n != 512)
+        panic("uvmunmap: megapage");
+      for(i = 0; b && i < 512; i++)
+        pgbatch_add(b, (void*)(PTE2PA(*pte) + i*PGSIZE));
+      *pte = 0;
       continue;
-    if(do_free){
-      uint64 pa = PTE2PA(*pte);
-      kfree((void*)pa);
     }
-    *pte = 0;
+    for(i = 0; i < n; i++){
+      if(PTE_ISSWAP(pte[i])){
+        swapfree(PTE2SLOT(pte[i]));
+        pte[i] = 0;
+      }
+      if((pte[i] & PTE_V) == 0)  // has physical page been allocated?
+        continue;
+      if(b && PTE2PA(pte[i]) != (uint64)zeropage)
+        pgbatch_add(b, (void*)PTE2PA(pte[i]));
+      pte[i] = 0;
+    }
+    if(n == 512){
+      // the whole page-table page is empty now.
+      pde = walklevel(pagetable, a, 0, 1, 0);
+      *pde = 0;
+      kfree(pte);
+    }
   }
 }
 
+// Remove npages of mappings starting from va. va must be
+// page-aligned. It's OK if the mappings don't exist.
+// Optionally free the physical memory.
+void
+uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
+{
+  struct pgbatch b;
+
+  b.n = 0;
+  unmaprange(pagetable, va, npages, do_free ? &b : 0);
+  tlbflush(pagetable, MAXVA);
+  pgbatch_flush(&b);
+}
+
 // Allocate PTEs and physical memory to grow a process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
+// Uses megapages for 2MB-aligned stretches when there is a free
+// physically contiguous block.
 uint64
 uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 {
   char *mem;
-  uint64 a;
+  uint64 a, n;
+  pte_t *pte;
+  int nomega = 0;
 
   if(newsz < oldsz)
     return oldsz;
 
   oldsz = PGROUNDUP(oldsz);
-  for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
-    if(mem == 0){
-      uvmdealloc(pagetable, a, oldsz);
-      return 0;
+  a = oldsz;
+  while(a < newsz){
+    if((a % MEGAPGSIZE) == 0 && newsz - a >= MEGAPGSIZE && !nomega &&
+       (pte = walklevel(pagetable, a, 1, 1, 0)) != 0 && *pte == 0){
+      // a failed kalloc_order() has already drained every
+      // hart's cache, so don't do it again for each 2MB.
+      if((mem = kalloc_order(MEGAORDER)) == 0){
+        nomega = 1;
+        continue;
+      }
+      memset(mem, 0, MEGAPGSIZE);
+      // the pages are freed one at a time, after a split.
+      ksplit(mem, MEGAORDER);
+      *pte = PA2PTE(mem) | PTE_R | PTE_U | xperm | PTE_V;
+      a += MEGAPGSIZE;
+      continue;
     }
-    memset(mem, 0, PGSIZE);
-    if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_R|PTE_U|xperm) != 0){
-      kfree(mem);
-      uvmdealloc(pagetable, a, oldsz);
-      return 0;
+    // fill in the rest of this page-table page.
+    if((pte = walk(pagetable, a, 1)) == 0)
+      goto bad;
+    for(n = leafrun(a, PGROUNDUP(newsz)); n > 0; n--, pte++){
+      if((mem = kalloc_reclaim(1)) == 0)
+        goto bad;
+      if(*pte & PTE_V)
+        panic("uvmalloc: remap");
+      *pte = PA2PTE(mem) | PTE_R | PTE_U | xperm | PTE_V;
+      a += PGSIZE;
     }
   }
   return newsz;
+
+ bad:
+  uvmdealloc(pagetable, a, oldsz);
+  return 0;
 }
 
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
-// process size.  Returns the new process size.
+// process size.  Returns the new process size, or oldsz if
+// out of memory to split a megapage that newsz falls in.
 uint64
 uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 {
+  pte_t *pte;
+  int level;
+
   if(newsz >= oldsz)
     return oldsz;
 
   if(PGROUNDUP(newsz) < PGROUNDUP(oldsz)){
+    pte = walklevel(pagetable, PGROUNDUP(newsz), 0, 0, &level);
+    if(pte && level == 1 && (*pte & PTE_V) &&
+       (PGROUNDUP(newsz) % MEGAPGSIZE) != 0 && splitmega(pte) < 0)
+      return oldsz;
     int npages = (PGROUNDUP(oldsz) - PGROUNDUP(newsz)) / PGSIZE;
     uvmunmap(pagetable, PGROUNDUP(newsz), npages, 1);
   }
@@ -259,8 +621,8 @@ uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 
 // Recursively free page-table pages.
 // All leaf mappings must already have been removed.
-void
-freewalk(pagetable_t pagetable)
+static void
+freewalk(pagetable_t pagetable, struct pgbatch *b)
 {
   // there are 2^9 = 512 PTEs in a page table.
   for(int i = 0; i < 512; i++){
@@ -268,13 +630,13 @@ freewalk(pagetable_t pagetable)
     if((pte & PTE_V) && (pte & (PTE_R|PTE_W|PTE_X)) == 0){
       // this PTE points to a lower-level page table.
       uint64 child = PTE2PA(pte);
-      freewalk((pagetable_t)child);
+      freewalk((pagetable_t)child, b);
       pagetable[i] = 0;
     } else if(pte & PTE_V){
       panic("freewalk: leaf");
     }
   }
-  kfree((void*)pagetable);
+  pgbatch_add(b, (void*)pagetable);
 }
 
 // Free user memory pages,
@@ -282,44 +644,80 @@ freewalk(pagetable_t pagetable)
 void
 uvmfree(pagetable_t pagetable, uint64 sz)
 {
+  struct pgbatch b;
+
+  b.n = 0;
   if(sz > 0)
-    uvmunmap(pagetable, 0, PGROUNDUP(sz)/PGSIZE, 1);
-  freewalk(pagetable);
+    unmaprange(pagetable, 0, PGROUNDUP(sz)/PGSIZE, &b);
+  freewalk(pagetable, &b);
+  pgbatch_flush(&b);
 }
 
-// Given a parent process's page table, copy
-// its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// Given a parent process's page table, make a
+// child's page table share its memory.
+// Writable pages become read-only and copy-on-write
+// in both page tables; vmfault() copies such a page
+// when either process writes to it.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
 uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
 {
-  pte_t *pte;
-  uint64 pa, i;
-  uint flags;
-  char *mem;
+  return uvmcopyrange(old, new, 0, sz, 0);
+}
 
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      continue;   // page table entry hasn't been allocated
-    if((*pte & PTE_V) == 0)
-      continue;   // physical page hasn't been allocated
-    pa = PTE2PA(*pte);
-    flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
-      goto err;
+// Like uvmcopy(), for the pages between start and end.
+// If share is set, the pages stay writable, and
+// writes by either process are seen by both.
+int
+uvmcopyrange(pagetable_t old, pagetable_t new, uint64 start, uint64 end, int share)
+{
+  pte_t *pte, *npte;
+  uint64 pa, a, n, i;
+  int level;
+
+  end = PGROUNDUP(end);
+  // a page-table page of PTEs at a time.
+  for(a = start; a < end; a += n*PGSIZE){
+    n = leafrun(a, end);
+    i = 0;
+    if((pte = walklevel(old, a, 0, 0, &level)) == 0)
+      continue;   // page table page hasn't been allocated
+    if(level == 1){
+      // share 4KB pages, so a write copies only one of them.
+      if(splitmega(pte) < 0)
+        goto err;
+      pte = walk(old, a, 0);
+    }
+    npte = 0;
+    for(; i < n; i++){
+      if((pte[i] & (PTE_V|PTE_SWAP)) == 0)
+        continue;   // physical page hasn't been allocated
+      if(npte == 0 && (npte = walk(new, a, 1)) == 0)
+        goto err;
+      if(npte[i] & (PTE_V|PTE_SWAP))
+        panic("uvmcopy: remap");
+      if(PTE_ISSWAP(pte[i])){
+        // share the swapped-out copy.
+        npte[i] = pte[i];
+        swapdup(PTE2SLOT(pte[i]));
+        continue;
+      }
+      pa = PTE2PA(pte[i]);
+      if((pte[i] & PTE_W) && !share)
+        pte[i] = (pte[i] & ~PTE_W) | PTE_COW;
+      npte[i] = PA2PTE(pa) | (PTE_FLAGS(pte[i]) & ~PTE_SPEC);
+      if(pa != (uint64)zeropage)
+        kdup((void*)pa);
     }
   }
+  // old's pages are read-only now.
+  tlbflush(old, MAXVA);
   return 0;
 
  err:
-  uvmunmap(new, 0, i / PGSIZE, 1);
+  tlbflush(old, MAXVA);
+  uvmunmap(new, start, (a + i*PGSIZE - start) / PGSIZE, 1);
   return -1;
 }
 
@@ -336,6 +734,135 @@ uvmclear(pagetable_t pagetable, uint64 va)
   *pte &= ~PTE_U;
 }
 
+// copyout() and friends reach user memory as the calling
+// process's p->ucopymode says, one of UCOPY_* in vm.h;
+// copymode() switches, for copybench. UCOPY_SUM needs the
+// user's page table to be the hart's, which it is during
+// system calls only if the kernel is mapped in it.
+// Otherwise the copy functions translate each user page
+// in software. A ucache remembers, for one copy, where the
+// last page's PTE was, so that the following pages of the
+// same 2MB need no walk from the root.
+struct ucache {
+  uint64 base;    // 2MB-aligned va that tbl covers
+  pte_t *tbl;     // level-0 page-table page, or megapage PTE; 0 if none
+  int level;      // of tbl
+  int walk;       // walk from the root every time: UCOPY_WALK
+};
+
+// a ucache for the calling process's copy mode.
+static struct ucache
+ucacheinit(void)
+{
+  struct ucache c = { 0 };
+  struct proc *p = myproc();
+
+  c.walk = p != 0 && p->ucopymode == UCOPY_WALK;
+  return c;
+}
+
+// The PTE for user address va (page-aligned), or 0, using
+// and filling in the cache c. *pa is set to va's physical
+// address if the PTE is a valid user leaf, else to 0.
+// Callers must empty the cache (c->tbl = 0) after anything
+// that might change the shape of the page table, such as
+// vmfault().
+static pte_t *
+uwalk(struct ucache *c, pagetable_t pagetable, uint64 va, uint64 *pa)
+{
+  pte_t *pte;
+  int level;
+
+  *pa = 0;
+  if(c->walk)
+    c->tbl = 0;
+  if(c->tbl && va - c->base < MEGAPGSIZE){
+    pte = c->level == 0 ? &c->tbl[PX(0, va)] : c->tbl;
+  } else {
+    if((pte = walklevel(pagetable, va, 0, 0, &level)) == 0)
+      return 0;
+    c->base = va - va % MEGAPGSIZE;
+    c->level = level;
+    c->tbl = level == 0 ? pte - PX(0, va) : pte;
+  }
+  if((*pte & (PTE_V|PTE_U)) == (PTE_V|PTE_U)){
+    *pa = PTE2PA(*pte);
+    if(c->level == 1)
+      *pa += va % MEGAPGSIZE;
+  }
+  return pte;
+}
+
+// Like uwalk(), but fault the page in if it isn't mapped,
+// or, for a write, if it's copy-on-write. Returns the
+// page's physical address, or 0.
+static uint64
+uwalkfault(struct ucache *c, pagetable_t pagetable, uint64 va, int write, pte_t **ptep)
+{
+  pte_t *pte;
+  uint64 pa;
+
+  pte = uwalk(c, pagetable, va, &pa);
+  if(pa == 0 || (write && (*pte & PTE_COW))){
+    c->tbl = 0;
+    if(vmfault(pagetable, va, !write) == 0)
+      return 0;
+    pte = uwalk(c, pagetable, va, &pa);
+    if(pa == 0 || (write && (*pte & PTE_COW)))
+      return 0;
+  }
+  *ptep = pte;
+  return pa;
+}
+
+#ifndef SPLITPT
+// 1 if a copy may use ucopy.S for [va, va+len) of pagetable:
+// the hart must be on pagetable, and, since SUM doesn't keep
+// the kernel out of pages without PTE_U, the range must be
+// user memory, and miss the stack's guard page.
+static int
+ucopyok(pagetable_t pagetable, uint64 va, uint64 len)
+{
+  struct proc *p = myproc();
+  uint64 end = va + len;
+
+  if(p == 0 || p->ucopymode != UCOPY_SUM || p->pagetable != pagetable)
+    return 0;
+  if((r_satp() & ((1L << SATP_ASIDSHIFT) - 1)) != (uint64)pagetable >> 12)
+    return 0;
+  if(end < va || (end > HEAPTOP && (va < MMAPBASE || end > MMAPTOP)))
+    return 0;
+  if(p->guard && va < p->guard + PGSIZE && end > p->guard)
+    return 0;
+  return 1;
+}
+#endif
+
+// kerneltrap() calls this for a page fault at user address
+// va in ucopy.S. Returns 1 if the load or store can be
+// retried, 0 if the copy should fail.
+int
+ucopyfault(uint64 va, int write)
+{
+  struct proc *p = myproc();
+  pte_t *pte;
+  int level;
+
+  va = PGROUNDDOWN(va);
+  if(vmfault(p->pagetable, va, !write) != 0)
+    return 1;
+  // vmfault() leaves a readable page alone, so the TLB had
+  // an entry from before it was mapped, or the hardware
+  // wants the kernel to set the accessed bit.
+  if(!write && (pte = walklevel(p->pagetable, va, 0, 0, &level)) != 0 &&
+     (*pte & (PTE_V|PTE_U|PTE_R)) == (PTE_V|PTE_U|PTE_R)){
+    *pte |= PTE_A;
+    tlbflush(p->pagetable, va);
+    return 1;
+  }
+  return 0;
+}
+
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
 // Return 0 on success, -1 on error.
@@ -343,24 +870,25 @@ int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
+  struct ucache c = ucacheinit();
   pte_t *pte;
 
+#ifndef SPLITPT
+  if(ucopyok(pagetable, dstva, len))
+    return ucopy((void *)dstva, src, len);
+#endif
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
     if(va0 >= MAXVA)
       return -1;
-  
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0) {
-      if((pa0 = vmfault(pagetable, va0, 0)) == 0) {
-        return -1;
-      }
-    }
 
-    pte = walk(pagetable, va0, 0);
+    if((pa0 = uwalkfault(&c, pagetable, va0, 1, &pte)) == 0)
+      return -1;
     // forbid copyout over read-only user text pages.
     if((*pte & PTE_W) == 0)
       return -1;
+    // the hardware doesn't see this write.
+    *pte |= PTE_D;
       
     n = PGSIZE - (dstva - va0);
     if(n > len)
@@ -381,15 +909,19 @@ int
 copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
   uint64 n, va0, pa0;
+  struct ucache c = ucacheinit();
+  pte_t *pte;
 
+#ifndef SPLITPT
+  if(ucopyok(pagetable, srcva, len))
+    return ucopy(dst, (void *)srcva, len);
+#endif
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0) {
-      if((pa0 = vmfault(pagetable, va0, 0)) == 0) {
-        return -1;
-      }
-    }
+    if(va0 >= MAXVA)
+      return -1;
+    if((pa0 = uwalkfault(&c, pagetable, va0, 0, &pte)) == 0)
+      return -1;
     n = PGSIZE - (srcva - va0);
     if(n > len)
       n = len;
@@ -402,6 +934,9 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
   return 0;
 }
 
+// non-zero if any byte of the word w is zero.
+#define HASZERO(w) (((w) - 0x0101010101010101UL) & ~(w) & 0x8080808080808080UL)
+
 // Copy a null-terminated string from user to kernel.
 // Copy bytes to dst from virtual address srcva in a given page table,
 // until a '\0', or max.
@@ -409,19 +944,47 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 int
 copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 {
-  uint64 n, va0, pa0;
+  uint64 n, va0, pa0, w;
+  struct ucache c = ucacheinit();
+  pte_t *pte;
   int got_null = 0;
 
+#ifndef SPLITPT
+  if(ucopyok(pagetable, srcva, max))
+    return ucopystr(dst, (char *)srcva, max);
+#endif
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if(va0 >= MAXVA)
+      return -1;
+    // faults in e.g. a string constant in a page of
+    // the program that hasn't been read in yet.
+    if((pa0 = uwalkfault(&c, pagetable, va0, 0, &pte)) == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
     if(n > max)
       n = max;
 
     char *p = (char *) (pa0 + (srcva - va0));
+    // a word at a time while neither side is misaligned
+    // and the word has no NUL in it.
+    if(((uint64)p % 8) == ((uint64)dst % 8)){
+      while(n > 0 && ((uint64)p % 8) != 0 && *p != '\0'){
+        *dst++ = *p++;
+        n--;
+        max--;
+      }
+      while(n >= 8){
+        w = *(uint64*)p;
+        if(HASZERO(w))
+          break;
+        *(uint64*)dst = w;
+        p += 8;
+        dst += 8;
+        n -= 8;
+        max -= 8;
+      }
+    }
     while(n > 0){
       if(*p == '\0'){
         *dst = '\0';
@@ -445,8 +1008,101 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
   }
 }
 
+// Give a process its own writable copy of the
+// copy-on-write page that pte maps. If no other page
+// table shares the page any more, just make it writable.
+// returns the page's physical address, or 0 if out of memory.
+static uint64
+cowcopy(pte_t *pte)
+{
+  uint64 pa;
+  char *mem;
+
+  pa = PTE2PA(*pte);
+  if(pa == (uint64)zeropage){
+    mem = kalloc_reclaim(1);
+  } else if(krefcnt((void*)pa) == 1){
+    *pte = (*pte & ~PTE_COW) | PTE_W;
+    return pa;
+  } else if((mem = kalloc_reclaim(0)) != 0){
+    memmove(mem, (char*)pa, PGSIZE);
+  }
+  if(mem == 0)
+    return 0;
+  *pte = PA2PTE(mem) | (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+  if(pa != (uint64)zeropage)
+    kfree((void*)pa);
+  return (uint64)mem;
+}
+
+// Map the not-yet-mapped pages of p's memory in the aligned
+// window of p->faultwin pages around va, as though the
+// process had just faulted on each of them, and mark them
+// PTE_SPEC. Leaves out pages of the program, which have to
+// be read in by segload() rather than zeroed. Gives up
+// quietly if memory is short.
+static void
+faultaround(struct proc *p, pagetable_t pagetable, uint64 va, int read)
+{
+  uint64 a, start, end, mem;
+  pte_t *pte;
+
+  if(p->faultwin <= 1)
+    return;
+  start = va - ((va / PGSIZE) % p->faultwin) * PGSIZE;
+  end = start + p->faultwin * PGSIZE;
+  if(end > PGROUNDUP(p->sz))
+    end = PGROUNDUP(p->sz);
+
+  for(a = start; a < end; a += PGSIZE){
+    if(a == va || seglookup(p, a) != 0)
+      continue;
+    if((pte = walk(pagetable, a, 1)) == 0)
+      return;
+    if(*pte & (PTE_V|PTE_SWAP))
+      continue;
+    if(read){
+      mem = (uint64)zeropage;
+      *pte = PA2PTE(mem) | PTE_R | PTE_U | PTE_COW | PTE_SPEC | PTE_V;
+    } else {
+      if((mem = (uint64)kalloc_zeroed()) == 0)
+        return;
+      *pte = PA2PTE(mem) | PTE_R | PTE_W | PTE_U | PTE_SPEC | PTE_V;
+    }
+    p->nspec++;
+  }
+}
+
+// Count the pages between start and end that fault-around
+// mapped and the process has since used (the hardware set
+// PTE_A), and clear their PTE_SPEC so they count only once.
+uint64
+uvmspecused(pagetable_t pagetable, uint64 start, uint64 end)
+{
+  uint64 a, n;
+  pte_t *pte;
+
+  n = 0;
+  for(a = PGROUNDDOWN(start); a < end; a += PGSIZE){
+    if((pte = walk(pagetable, a, 0)) == 0)
+      continue;
+    if((*pte & (PTE_V|PTE_SPEC|PTE_A)) == (PTE_V|PTE_SPEC|PTE_A)){
+      *pte &= ~PTE_SPEC;
+      n++;
+    }
+  }
+  return n;
+}
+
 // allocate and map user memory if process is referencing a page
-// that was lazily allocated in sys_sbrk().
+// that was lazily allocated in sys_sbrk(), or copy a
+// copy-on-write page that it is writing to.
+// a read maps the shared zero page, copy-on-write, instead
+// of allocating; the first write replaces it.
+// also maps the neighbouring pages; see faultaround().
+// above p->sz, va must lie in a region set up by mmap(),
+// which may get the page from a file. pages of the program
+// itself are read in from its file.
 // returns 0 if va is invalid or already mapped, or if
 // out of physical memory, and physical address if successful.
 uint64
@@ -454,22 +1110,126 @@ vmfault(pagetable_t pagetable, uint64 va, int read)
 {
   uint64 mem;
   struct proc *p = myproc();
+  struct vma *v = 0;
+  struct seg *sg = 0;
+  pte_t *pte;
+  int perm = PTE_W|PTE_U|PTE_R;
 
-  if (va >= p->sz)
-    return 0;
+  if (va >= p->sz){
+    // in a region set up by mmap()?
+    if((v = vmalookup(p, va)) == 0)
+      return 0;
+    if((v->prot & (read ? PROT_READ : PROT_WRITE)) == 0)
+      return 0;
+    perm = vmaperm(v);
+  } else if((sg = seglookup(p, va)) != 0){
+    // part of the program, not yet read in.
+    if(!read && (sg->perm & PTE_W) == 0)
+      return 0;
+  }
   va = PGROUNDDOWN(va);
+  if((pte = walk(pagetable, va, 0)) != 0 && PTE_ISSWAP(*pte))
+    return swapin(pte);
   if(ismapped(pagetable, va)) {
+    pte = walk(pagetable, va, 0);
+    if(!read && (*pte & PTE_COW)){
+      if(*pte & PTE_SPEC){
+        // a write to a zero page that fault-around mapped.
+        *pte &= ~PTE_SPEC;
+        p->nspecused++;
+      }
+      if((mem = cowcopy(pte)) != 0)
+        tlbflush(pagetable, va);
+      return mem;
+    }
+    if(!read && (*pte & (PTE_U|PTE_W)) == (PTE_U|PTE_W)){
+      // the PTE allows the write, so the TLB had an entry
+      // from before it did, or the hardware wants the kernel
+      // to set the dirty bit.
+      *pte |= PTE_A | PTE_D;
+      tlbflush(pagetable, va);
+      return walkaddr(pagetable, va);
+    }
     return 0;
   }
-  mem = (uint64) kalloc();
-  if(mem == 0)
+  if(v && v->f)
+    return vmaload(pagetable, v, va);
+  if(sg)
+    return segload(pagetable, p, sg, va);
+  if(read && !(v && (v->flags & MAP_SHARED))){
+    mem = (uint64)zeropage;
+    if(mappages(pagetable, va, PGSIZE, mem, PTE_R|PTE_U|PTE_COW) != 0)
+      return 0;
+  } else {
+    mem = (uint64) kalloc_reclaim(1);
+    if(mem == 0)
+      return 0;
+    if (mappages(pagetable, va, PGSIZE, mem, perm) != 0) {
+      kfree((void *)mem);
+      return 0;
+    }
+  }
+  if(v == 0)
+    faultaround(p, pagetable, va, read);
+  return mem;
+}
+
+// The PTE for va, if it maps a 4KB page of user memory
+// that could be swapped out: not copy-on-write, and mapped
+// by no other page table. If the page has been used since
+// the last look, clear PTE_A and return 0 instead, to give
+// it another chance.
+pte_t *
+uvmswappable(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  int level;
+
+  if((pte = walklevel(pagetable, va, 0, 0, &level)) == 0 || level != 0)
     return 0;
-  memset((void *) mem, 0, PGSIZE);
-  if (mappages(p->pagetable, va, PGSIZE, mem, PTE_W|PTE_U|PTE_R) != 0) {
-    kfree((void *)mem);
+  if((*pte & (PTE_V|PTE_U|PTE_COW)) != (PTE_V|PTE_U))
+    return 0;
+  if(krefcnt((void*)PTE2PA(*pte)) != 1)
+    return 0;
+  if(*pte & PTE_A){
+    *pte &= ~PTE_A;
     return 0;
   }
-  return mem;
+  return pte;
+}
+
+// The PTE for va, if it maps a private, writable 4KB page
+// of user memory, which ksm.c might merge with another.
+pte_t *
+uvmmergeable(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  int level;
+
+  if((pte = walklevel(pagetable, va, 0, 0, &level)) == 0 || level != 0)
+    return 0;
+  if((*pte & (PTE_V|PTE_U|PTE_W|PTE_COW)) != (PTE_V|PTE_U|PTE_W))
+    return 0;
+  if(krefcnt((void*)PTE2PA(*pte)) != 1)
+    return 0;
+  return pte;
+}
+
+// Map the page at pa, whose contents are the same as the
+// page that pte maps, or the zero page if pa is 0, in place
+// of that page, copy-on-write. pa may be the same page.
+// The caller must flush the TLB.
+void
+uvmmerge(pte_t *pte, uint64 pa)
+{
+  uint64 old = PTE2PA(*pte);
+
+  if(pa)
+    kdup((void*)pa);
+  else
+    pa = (uint64)zeropage;
+  *pte = PA2PTE(pa) | (PTE_FLAGS(*pte) & ~(PTE_W|PTE_D)) | PTE_COW;
+  kfree((void*)old);
 }
 
 int
@@ -1,2 +1,19 @@
 #define SBRK_EAGER 1
 #define SBRK_LAZY  2
+
+// how the kernel copies to and from user memory; copymode().
+#define UCOPY_WALK  0  // walk the page table for each page
+#define UCOPY_CACHE 1  // ... from the last level-0 table, if it can
+#define UCOPY_SUM   2  // loads and stores under sstatus.SUM
+#ifdef SPLITPT
+#define UCOPY_DEFAULT UCOPY_CACHE  // the kernel has its own page table
+#else
+#define UCOPY_DEFAULT UCOPY_SUM
+#endif
+
+// filled in by faultaround().
+struct vmstat {
+  int faultwin;      // fault-around window, in pages
+  uint64 nspec;      // pages mapped ahead of a fault
+  uint64 nspecused;  // ... that the process then used
+};
@@ -0,0 +1,316 @@
+//
+// Compressed swap in memory: a swapped-out page that
+// compresses well is kept, compressed, in a pool of kernel
+// memory rather than written to disk, so that swapping it
+// back in takes a decompression instead of a disk read.
+// swap.c decides which pages go where; see swapout().
+//
+// The codec is a small LZ77 in the style of LZ4: a stream
+// of sequences, each a token byte (literal count in the
+// high nibble, match length - 4 in the low, 15 meaning more
+// length bytes follow), the literals, and a two-byte offset
+// back into the output. The last sequence has no match.
+//
+// Compressed pages are kept in pool pages, each holding k
+// equal-sized objects for some k between 2 and ZRAMCLASSES.
+// Pages of zeros take no room in the pool at all.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "kstat.h"
+
+extern struct kstat kstat;
+
+#define MINMATCH    4
+#define ZHASHBITS   10
+#define ZRAMCLASSES 64   // most objects per pool page
+
+// at the start of each pool page.
+struct zhdr {
+  struct zhdr *next;  // next pool page of the same class
+  uint64 used;        // bitmap of objects in use
+  int k;              // objects per page
+};
+
+#define ZOBJSIZE(k) (((PGSIZE - sizeof(struct zhdr)) / (k)) & ~7L)
+#define ZFULL(k)    ((k) == 64 ? ~0UL : (1UL << (k)) - 1)
+#define ZRAMMAX     ZOBJSIZE(2)  // compressed pages must fit in this
+
+struct {
+  struct spinlock lock;
+  struct zhdr *class[ZRAMCLASSES+1];  // pool pages, by objects per page
+  void *obj[NZRAM];     // each page's object, 0 if all zeros
+  ushort len[NZRAM];    // its compressed length
+
+  // compression output and hash table; swapreclaim()
+  // only compresses one page at a time.
+  uchar buf[ZRAMMAX];
+  ushort hash[1 << ZHASHBITS];
+} zram;
+
+void
+zraminit(void)
+{
+  initlock(&zram.lock, "zram");
+}
+
+static uint
+load32(uchar *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint)p[3] << 24);
+}
+
+// Append the bytes that extend a length of 15 + n.
+static uchar *
+putlen(uchar *op, uchar *oend, int n)
+{
+  for(; n >= 255; n -= 255){
+    if(op >= oend)
+      return 0;
+    *op++ = 255;
+  }
+  if(op >= oend)
+    return 0;
+  *op++ = n;
+  return op;
+}
+
+// Append a sequence: lit literals from lp, then a match
+// of len bytes at off back, if len isn't 0.
+static uchar *
+putseq(uchar *op, uchar *oend, uchar *lp, int lit, int off, int len)
+{
+  uchar *tok;
+  int m = len ? len - MINMATCH : 0;
+
+  if(op >= oend)
+    return 0;
+  tok = op++;
+  *tok = ((lit < 15 ? lit : 15) << 4) | (m < 15 ? m : 15);
+  if(lit >= 15 && (op = putlen(op, oend, lit - 15)) == 0)
+    return 0;
+  if(lit > oend - op)
+    return 0;
+  memmove(op, lp, lit);
+  op += lit;
+  if(len == 0)
+    return op;
+  if(oend - op < 2)
+    return 0;
+  *op++ = off;
+  *op++ = off >> 8;
+  if(m >= 15 && (op = putlen(op, oend, m - 15)) == 0)
+    return 0;
+  return op;
+}
+
+// Compress n bytes at src into dst. Returns the compressed
+// length, or -1 if it would be more than max.
+static int
+lzcompress(uchar *src, int n, uchar *dst, int max)
+{
+  uchar *ip = src, *anchor = src, *end = src + n;
+  uchar *op = dst, *oend = dst + max, *ref;
+  uint h;
+  int len;
+
+  memset(zram.hash, 0, sizeof(zram.hash));
+  while(end - ip >= MINMATCH){
+    h = (load32(ip) * 2654435761U) >> (32 - ZHASHBITS);
+    ref = src + zram.hash[h];
+    zram.hash[h] = ip - src;
+    if(ref >= ip || load32(ref) != load32(ip)){
+      ip++;
+      continue;
+    }
+    for(len = MINMATCH; ip + len < end && ref[len] == ip[len]; len++)
+      ;
+    if((op = putseq(op, oend, anchor, ip - anchor, ip - ref, len)) == 0)
+      return -1;
+    ip += len;
+    anchor = ip;
+  }
+  if((op = putseq(op, oend, anchor, end - anchor, 0, 0)) == 0)
+    return -1;
+  return op - dst;
+}
+
+// Read a length whose token nibble was n.
+static int
+getlen(uchar **pp, uchar *end, int n)
+{
+  uchar *p = *pp;
+  int c;
+
+  if(n == 15){
+    do {
+      if(p >= end)
+        return -1;
+      c = *p++;
+      n += c;
+    } while(c == 255);
+  }
+  *pp = p;
+  return n;
+}
+
+// Decompress n bytes at src into dst, which has room for
+// max. Returns the decompressed length, or -1 if src is
+// malformed.
+static int
+lzdecompress(uchar *src, int n, uchar *dst, int max)
+{
+  uchar *ip = src, *end = src + n;
+  uchar *op = dst, *oend = dst + max, *ref;
+  int tok, lit, off, len;
+
+  while(ip < end){
+    tok = *ip++;
+    if((lit = getlen(&ip, end, tok >> 4)) < 0 || lit > end - ip || lit > oend - op)
+      return -1;
+    memmove(op, ip, lit);
+    op += lit;
+    ip += lit;
+    if(ip == end)
+      break;
+    if(end - ip < 2)
+      return -1;
+    off = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if((len = getlen(&ip, end, tok & 15)) < 0)
+      return -1;
+    len += MINMATCH;
+    if(off == 0 || off > op - dst || len > oend - op)
+      return -1;
+    // byte by byte: the match may overlap its own output.
+    for(ref = op - off; len > 0; len--)
+      *op++ = *ref++;
+  }
+  return op - dst;
+}
+
+// Compress the page at pa into zram.buf. Returns the
+// compressed length, 0 if the page is all zeros, or -1
+// if it doesn't compress well enough to be worth keeping.
+// The caller must not compress another page before
+// zramsave().
+int
+zramcompress(void *pa)
+{
+  uint64 *w = (uint64*)pa;
+  int i;
+
+  for(i = 0; i < PGSIZE/8 && w[i] == 0; i++)
+    ;
+  if(i == PGSIZE/8)
+    return 0;
+  return lzcompress(pa, PGSIZE, zram.buf, ZRAMMAX);
+}
+
+// Allocate an object of at least n bytes. If there's no
+// room in the pool and no free memory, use the page at
+// *spare for the pool and set *spare to 0.
+// Caller holds zram.lock.
+static void *
+zalloc(int n, void **spare)
+{
+  struct zhdr *z;
+  int k, i;
+
+  k = (PGSIZE - sizeof(struct zhdr)) / ((n + 7) & ~7);
+  if(k > ZRAMCLASSES)
+    k = ZRAMCLASSES;
+  for(z = zram.class[k]; z; z = z->next)
+    if(z->used != ZFULL(k))
+      break;
+  if(z == 0){
+    if((z = kalloc()) == 0){
+      if((z = *spare) == 0)
+        return 0;
+      *spare = 0;
+    }
+    z->used = 0;
+    z->k = k;
+    z->next = zram.class[k];
+    zram.class[k] = z;
+    kstat.zrampool++;
+  }
+  for(i = 0; z->used & (1UL << i); i++)
+    ;
+  z->used |= 1UL << i;
+  return (char*)(z + 1) + i * ZOBJSIZE(k);
+}
+
+// Free an object from zalloc(), and its pool page if
+// that was the page's last. Caller holds zram.lock.
+static void
+zfree(void *obj)
+{
+  struct zhdr *z, **pp;
+  int i;
+
+  z = (struct zhdr*)PGROUNDDOWN((uint64)obj);
+  i = ((char*)obj - (char*)(z + 1)) / ZOBJSIZE(z->k);
+  if((z->used & (1UL << i)) == 0)
+    panic("zfree");
+  z->used &= ~(1UL << i);
+  if(z->used == 0){
+    for(pp = &zram.class[z->k]; *pp != z; pp = &(*pp)->next)
+      ;
+    *pp = z->next;
+    kstat.zrampool--;
+    kfree(z);
+  }
+}
+
+// Keep the n bytes that zramcompress() left in zram.buf
+// as compressed page i, taking the page at *spare for the
+// pool if memory has run out.
+void
+zramsave(int i, int n, void **spare)
+{
+  void *obj = 0;
+
+  acquire(&zram.lock);
+  if(n > 0){
+    if((obj = zalloc(n, spare)) == 0)
+      panic("zramsave");
+    memmove(obj, zram.buf, n);
+  }
+  zram.obj[i] = obj;
+  zram.len[i] = n;
+  kstat.zramused++;
+  kstat.zrambytes += n;
+  release(&zram.lock);
+}
+
+// Decompress page i into the page at pa. The caller's
+// reference to i keeps it from being freed meanwhile.
+void
+zramload(int i, void *pa)
+{
+  if(zram.len[i] == 0){
+    memset(pa, 0, PGSIZE);
+    return;
+  }
+  if(lzdecompress(zram.obj[i], zram.len[i], pa, PGSIZE) != PGSIZE)
+    panic("zramload");
+}
+
+// Page i is no longer needed.
+void
+zramfree(int i)
+{
+  acquire(&zram.lock);
+  if(zram.obj[i])
+    zfree(zram.obj[i]);
+  kstat.zramused--;
+  kstat.zrambytes -= zram.len[i];
+  zram.obj[i] = 0;
+  zram.len[i] = 0;
+  release(&zram.lock);
+}
@@ -0,0 +1,100 @@
+// Time the system calls that spend most of their effort
+// copying to and from user memory: a long path through
+// copyinstr(), and a large read and a pipe round trip
+// through copyin() and copyout(). Prints time counter
+// ticks per call, for each way the kernel can copy; see
+// copymode().
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/fcntl.h"
+#include "kernel/vm.h"
+
+#define N 200
+
+static char buf[32*1024];
+
+static void
+report(char *what, uint64 t0, int bytes)
+{
+  uint64 t = (rdtime() - t0) / N;
+
+  printf("%s: %lu ticks/call", what, t);
+  if(bytes && t)
+    printf(", %lu bytes/tick", bytes / t);
+  printf("\n");
+}
+
+static void
+bench(void)
+{
+  char path[MAXPATH];
+  int fd, i, p[2];
+  uint64 t0;
+
+  // a path that's long, and not there, so that open()
+  // copies it in and finds nothing without touching the disk.
+  memset(path, 'a', sizeof(path) - 1);
+  path[sizeof(path) - 1] = 0;
+  t0 = rdtime();
+  for(i = 0; i < N; i++)
+    open(path, O_RDONLY);
+  report("open long path", t0, sizeof(path));
+
+  fd = open("copybench.tmp", O_CREATE|O_RDWR|O_TRUNC);
+  if(fd < 0 || write(fd, buf, sizeof(buf)) != sizeof(buf)){
+    fprintf(2, "copybench: cannot write copybench.tmp\n");
+    exit(1);
+  }
+  close(fd);
+  fd = open("copybench.tmp", O_RDONLY);
+  read(fd, buf, sizeof(buf));  // fault in buf
+  t0 = rdtime();
+  for(i = 0; i < N; i++){
+    close(fd);
+    fd = open("copybench.tmp", O_RDONLY);
+    read(fd, buf, sizeof(buf));
+  }
+  report("read 32KB", t0, sizeof(buf));
+  close(fd);
+  unlink("copybench.tmp");
+
+  if(pipe(p) < 0){
+    fprintf(2, "copybench: pipe failed\n");
+    exit(1);
+  }
+  t0 = rdtime();
+  for(i = 0; i < N; i++){
+    write(p[1], buf, 512);
+    read(p[0], buf, 512);
+  }
+  report("pipe 512 bytes", t0, 512);
+  close(p[0]);
+  close(p[1]);
+}
+
+int
+main(int argc, char *argv[])
+{
+  static char *names[] = {
+  [UCOPY_WALK]  "walk each page",
+  [UCOPY_CACHE] "cached walk",
+  [UCOPY_SUM]   "SUM",
+  };
+  int mode, old;
+
+  if((old = copymode(-1)) < 0){
+    fprintf(2, "copybench: copymode failed\n");
+    exit(1);
+  }
+  for(mode = UCOPY_WALK; mode <= UCOPY_SUM; mode++){
+    if(copymode(mode) < 0)
+      continue;  // no SUM on a kernel with its own page table
+    printf("%s:\n", names[mode]);
+    bench();
+  }
+  copymode(old);
+  exit(0);
+}
@@ -0,0 +1,124 @@
+// Time how long a process woken, or forked, by a busy
+// process waits before it runs on another hart: the parent
+// writes the time to a pipe, or forks, and then keeps its
+// own hart busy for SPIN, so that only an idle hart can
+// run the other process promptly. It sleeps between
+// rounds to let the other harts go idle. Prints the
+// average and worst latency in microseconds, and how many
+// times a hart was kicked out of wfi to run a process.
+// Compare CPUS=1 with more, and kernels with and without
+// interrupts between harts.
+//
+// usage: ipibench [rounds]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/kstat.h"
+#include "user/user.h"
+
+#define SPIN 50000     // time counter ticks the parent stays busy, 5ms
+#define GAP  2000000   // ns to sleep between rounds
+#define MAXROUNDS 1000
+
+static void
+spin(void)
+{
+  uint64 end = rdtime() + SPIN;
+
+  while(rdtime() < end)
+    ;
+}
+
+static void
+report(char *s, uint64 sum, uint64 max, int n)
+{
+  // the time counter counts at 10MHz under qemu.
+  printf("%s avg %lu.%lu us, max %lu.%lu us\n", s,
+         sum / n / 10, sum / n % 10, max / 10, max % 10);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n = 100;
+  int tp[2], rp[2];
+  int i, pid;
+  uint64 t, sum, max, r[2];
+  struct kstat st0, st;
+
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n < 1 || n > MAXROUNDS){
+    fprintf(2, "usage: ipibench [rounds], at most %d\n", MAXROUNDS);
+    exit(1);
+  }
+  if(pipe(tp) < 0 || pipe(rp) < 0){
+    fprintf(2, "ipibench: pipe failed\n");
+    exit(1);
+  }
+  kstat(&st0);
+
+  // a reader blocked on a pipe.
+  if((pid = fork()) < 0){
+    fprintf(2, "ipibench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    sum = max = 0;
+    for(i = 0; i < n; i++){
+      if(read(tp[0], &t, sizeof(t)) != sizeof(t))
+        exit(1);
+      t = rdtime() - t;
+      sum += t;
+      if(t > max)
+        max = t;
+    }
+    r[0] = sum;
+    r[1] = max;
+    write(rp[1], r, sizeof(r));
+    exit(0);
+  }
+  for(i = 0; i < n; i++){
+    nsleep(GAP);
+    t = rdtime();
+    write(tp[1], &t, sizeof(t));
+    spin();
+  }
+  if(read(rp[0], r, sizeof(r)) != sizeof(r)){
+    fprintf(2, "ipibench: reader failed\n");
+    exit(1);
+  }
+  wait(0);
+  report("wakeup to run:", r[0], r[1], n);
+
+  // a new child.
+  sum = max = 0;
+  for(i = 0; i < n; i++){
+    nsleep(GAP);
+    t = rdtime();
+    if((pid = fork()) < 0){
+      fprintf(2, "ipibench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      t = rdtime() - t;
+      write(rp[1], &t, sizeof(t));
+      exit(0);
+    }
+    spin();
+    if(read(rp[0], &t, sizeof(t)) != sizeof(t)){
+      fprintf(2, "ipibench: child failed\n");
+      exit(1);
+    }
+    wait(0);
+    sum += t;
+    if(t > max)
+      max = t;
+  }
+  report("fork to run:  ", sum, max, n);
+
+  kstat(&st);
+  printf("%lu kicks\n", st.ipi - st0.ipi);
+  exit(0);
+}
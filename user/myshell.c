@@ -2,7 +2,7 @@
 // Author: Yifan Wan
 //
 // Features:
-//   • run external programs (fork + exec + wait)
+//   • run external programs (spawn + wait)
 //   • built-ins: cd, exit
 //   • input/output redirection (<, >)
 //   • single pipeline (a | b)
@@ -15,6 +15,7 @@
 #include "kernel/stat.h"
 #include "user/user.h"
 #include "kernel/fcntl.h"
+#include "kernel/spawn.h"
 
 #define MAXARGS 16
 #define MAXLINE 256
@@ -49,31 +50,42 @@ int split(char *buf, char **argv, int max) {
 
 void runcmd(char *line);
 
+// start argv with fd made its descriptor newfd (if fd >= 0)
+// and the descriptors in closefd[0..nclose) closed.
+// returns 1 if it started, 0 if not.
+int start(char *argv[], int fd, int newfd, int *closefd, int nclose) {
+  struct spawnact act[3];
+  int n = 0;
+  if (fd >= 0) {
+    act[n].op = SPAWN_DUP2;
+    act[n].fd = fd;
+    act[n].newfd = newfd;
+    n++;
+  }
+  for (int i = 0; i < nclose; i++) {
+    act[n].op = SPAWN_CLOSE;
+    act[n].fd = closefd[i];
+    n++;
+  }
+  if (spawn(argv[0], argv, act, n) < 0) {
+    printf("exec %s failed\n", argv[0]);
+    return 0;
+  }
+  return 1;
+}
+
 void runpipeline(char *cmd1[], char *cmd2[]) {
   int p[2];
-  pipe(p);
-  if (fork() == 0) {
-    close(1);
-    dup(p[1]);
-    close(p[0]);
-    close(p[1]);
-    exec(cmd1[0], cmd1);
-    printf("exec %s failed\n", cmd1[0]);
-    exit(1);
-  }
-  if (fork() == 0) {
-    close(0);
-    dup(p[0]);
-    close(p[0]);
-    close(p[1]);
-    exec(cmd2[0], cmd2);
-    printf("exec %s failed\n", cmd2[0]);
-    exit(1);
+  if (pipe(p) < 0) {
+    printf("pipe failed\n");
+    return;
   }
+  int n = start(cmd1, p[1], 1, p, 2);
+  n += start(cmd2, p[0], 0, p, 2);
   close(p[0]);
   close(p[1]);
-  wait(0);
-  wait(0);
+  while (n-- > 0)
+    wait(0);
 }
 
 void runcmd(char *line) {
@@ -125,27 +137,21 @@ void runcmd(char *line) {
     }
   }
 
-  if (fork() == 0) {
-    if (infile) {
-      int fd = open(infile, O_RDONLY);
-      if (fd < 0) { printf("open %s failed\n", infile); exit(1); }
-      close(0);
-      dup(fd);
-      close(fd);
-    }
-    if (outfile) {
-      int fd = open(outfile, O_WRONLY | O_CREATE | O_TRUNC);
-      if (fd < 0) { printf("open %s failed\n", outfile); exit(1); }
-      close(1);
-      dup(fd);
-      close(fd);
-    }
-    exec(argv[0], argv);
-    printf("exec %s failed\n", argv[0]);
-    exit(1);
+  int fd = -1, newfd = 0;
+  if (infile) {
+    fd = open(infile, O_RDONLY);
+    if (fd < 0) { printf("open %s failed\n", infile); return; }
+  }
+  if (outfile) {
+    fd = open(outfile, O_WRONLY | O_CREATE | O_TRUNC);
+    if (fd < 0) { printf("open %s failed\n", outfile); return; }
+    newfd = 1;
   }
+  int started = start(argv, fd, newfd, &fd, fd >= 0);
+  if (fd >= 0)
+    close(fd);
 
-  if (!background)
+  if (started && !background)
     wait(0);
 }
 
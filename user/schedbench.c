@@ -0,0 +1,92 @@
+// Time the scheduler with many RUNNABLE processes: start
+// nspin processes that only spin, then time npairs pairs
+// of processes passing a byte back and forth through
+// pipes, which sleep and wake at every step. Prints time
+// counter ticks per 1000 round trips, and how many times a
+// hart took a process from another hart's run queue.
+// Compare kernels, and CPUS=3 with CPUS=8, by running it
+// on each.
+//
+// usage: schedbench [nspin [npairs]]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/kstat.h"
+#include "user/user.h"
+
+#define N 2000      // round trips per pair
+#define MAXPROC 48
+
+int
+main(int argc, char *argv[])
+{
+  int nspin = 8, npairs = 4;
+  int spin[MAXPROC], ping[2], pong[2];
+  int i, j, k, pid;
+  struct kstat st0, st;
+  uint64 t0, t;
+  char c;
+
+  if(argc > 1)
+    nspin = atoi(argv[1]);
+  if(argc > 2)
+    npairs = atoi(argv[2]);
+  if(nspin < 0 || nspin > MAXPROC || npairs < 1 || nspin + 2*npairs > MAXPROC){
+    fprintf(2, "usage: schedbench [nspin [npairs]], at most %d processes\n", MAXPROC);
+    exit(1);
+  }
+
+  for(i = 0; i < nspin; i++){
+    if((spin[i] = fork()) < 0){
+      fprintf(2, "schedbench: fork failed\n");
+      exit(1);
+    }
+    if(spin[i] == 0)
+      for(;;)
+        ;
+  }
+
+  kstat(&st0);
+  t0 = rdtime();
+  for(i = 0; i < npairs; i++){
+    if(pipe(ping) < 0 || pipe(pong) < 0){
+      fprintf(2, "schedbench: pipe failed\n");
+      exit(1);
+    }
+    for(k = 0; k < 2; k++){
+      if((pid = fork()) < 0){
+        fprintf(2, "schedbench: fork failed\n");
+        exit(1);
+      }
+      if(pid == 0){
+        for(j = 0; j < N; j++){
+          if(k == 0 && write(ping[1], "x", 1) != 1)
+            exit(1);
+          if(read(k == 0 ? pong[0] : ping[0], &c, 1) != 1)
+            exit(1);
+          if(k == 1 && write(pong[1], "x", 1) != 1)
+            exit(1);
+        }
+        exit(0);
+      }
+    }
+    close(ping[0]);
+    close(ping[1]);
+    close(pong[0]);
+    close(pong[1]);
+  }
+  for(i = 0; i < 2*npairs; i++)
+    wait(0);
+  t = rdtime() - t0;
+  kstat(&st);
+
+  for(i = 0; i < nspin; i++){
+    kill(spin[i]);
+    wait(0);
+  }
+
+  printf("%d spinning, %d pairs: %lu ticks/1000 round trips, %lu steals\n",
+         nspin, npairs, t * 1000 / ((uint64)N * npairs), st.runqsteal - st0.runqsteal);
+  exit(0);
+}
@@ -2,10 +2,12 @@
 #include "kernel/stat.h"
 #include "user/user.h"
 #include "kernel/fcntl.h"
+#include "kernel/spawn.h"
 
 #define MAX_HISTORY 100
 #define MAX_CMD_LEN 128
 #define MAX_ARGS 16
+#define MAX_ACTS 16
 
 // --- History Entry Structure ---
 struct history_entry {
@@ -50,20 +52,22 @@ char *next_token(char **str_ptr, const char *delim) {
   return current_ptr;
 }
 
-// --- Path Execution Logic (execvp) ---
+// --- Path Execution Logic (spawnvp) ---
 // Priority:
 // 1. Absolute/Relative path (contains '/') -> Run directly
 // 2. Root directory (e.g., /ls)
 // 3. Current directory (e.g., ls)
-void
-execvp(char *cmd, char **args)
+// Returns the child's pid, or -1.
+int
+spawnvp(char *cmd, char **args, struct spawnact *acts, int nacts)
 {
+  int pid;
+
   // 1. Check if it contains a slash (Absolute or relative path)
   if(strchr(cmd, '/') != 0){
-    exec(cmd, args);
-    // If we are here, exec failed
-    fprintf(2, "exec: %s failed\n", cmd);
-    exit(1);
+    pid = spawn(cmd, args, acts, nacts);
+    if(pid < 0) fprintf(2, "exec: %s failed\n", cmd);
+    return pid;
   }
 
   // 2. Try Root Directory First (e.g. /ls)
@@ -78,15 +82,28 @@ execvp(char *cmd, char **args)
   }
   *p = 0; // Null terminate
   
-  exec(buf, args);
+  if((pid = spawn(buf, args, acts, nacts)) >= 0) return pid;
   // If we are here, finding it in / failed.
 
   // 3. Try Current Directory
-  exec(cmd, args);
+  if((pid = spawn(cmd, args, acts, nacts)) >= 0) return pid;
   
   // 4. Final Failure (Found nowhere)
   fprintf(2, "exec: %s failed\n", cmd);
-  exit(1);
+  return -1;
+}
+
+// Add an action making fd the child's newfd, then closing fd.
+int
+addredir(struct spawnact *acts, int nacts, int fd, int newfd)
+{
+  if(nacts + 2 > MAX_ACTS) return -1;
+  acts[nacts].op = SPAWN_DUP2;
+  acts[nacts].fd = fd;
+  acts[nacts].newfd = newfd;
+  acts[nacts+1].op = SPAWN_CLOSE;
+  acts[nacts+1].fd = fd;
+  return nacts + 2;
 }
 
 // --- Main Shell Logic ---
@@ -230,55 +247,57 @@ int main(int argc, char *argv[]) {
                 if(pipe(curr_pipe) < 0){ fprintf(2, "pipe failed\n"); break; }
             }
 
-            int pid = fork();
-            if(pid < 0){ fprintf(2, "fork failed\n"); break; }
+            // The child's descriptors are set up by spawn() actions,
+            // so the shell never has to fork a copy of itself.
+            struct spawnact acts[MAX_ACTS];
+            int nacts = 0;
+            if(prev_pipe_read != -1)
+                nacts = addredir(acts, nacts, prev_pipe_read, 0);
+            if(i < num_cmds - 1){
+                nacts = addredir(acts, nacts, curr_pipe[1], 1);
+                acts[nacts].op = SPAWN_CLOSE; acts[nacts].fd = curr_pipe[0]; nacts++;
+            }
 
-            if(pid == 0){
-                // === CHILD PROCESS ===
-                if(prev_pipe_read != -1){
-                    close(0); dup(prev_pipe_read); close(prev_pipe_read);
-                }
-                if(i < num_cmds - 1){
-                    close(1); dup(curr_pipe[1]); close(curr_pipe[0]); close(curr_pipe[1]);
+            // Handle Redirection
+            int redir_fds[MAX_ARGS];
+            int nredir = 0;
+            int ok = 1;
+            for(int j=0; c_args[j] != 0; j++){
+                char *redir = c_args[j];
+                char *fname = c_args[j+1];
+
+                if(strcmp(redir, "<") == 0 || strcmp(redir, ">") == 0 || strcmp(redir, ">>") == 0){
+                     if(fname == 0){ fprintf(2, "syntax error\n"); ok = 0; break; }
+
+                     int fd = -1, newfd = 1;
+                     if(strcmp(redir, "<") == 0){
+                         fd = open(fname, O_RDONLY);
+                         newfd = 0;
+                     } else if(strcmp(redir, ">") == 0){
+                         fd = open(fname, O_WRONLY|O_CREATE|O_TRUNC);
+                     } else if(strcmp(redir, ">>") == 0){
+                         fd = open(fname, O_WRONLY|O_CREATE|O_APPEND);
+                     }
+                     if(fd < 0){ fprintf(2, "cannot open %s\n", fname); ok = 0; break; }
+                     redir_fds[nredir++] = fd;
+                     if((nacts = addredir(acts, nacts, fd, newfd)) < 0){ fprintf(2, "too many redirections\n"); ok = 0; break; }
+                     c_args[j] = 0; 
                 }
+            }
 
-                // Handle Redirection
-                for(int j=0; c_args[j] != 0; j++){
-                    char *redir = c_args[j];
-                    char *fname = c_args[j+1];
-
-                    if(strcmp(redir, "<") == 0 || strcmp(redir, ">") == 0 || strcmp(redir, ">>") == 0){
-                         if(fname == 0){ fprintf(2, "syntax error\n"); exit(1); }
-                         
-                         if(strcmp(redir, "<") == 0){
-                             close(0);
-                             if(open(fname, O_RDONLY) < 0){ fprintf(2, "cannot open %s\n", fname); exit(1); }
-                         } else if(strcmp(redir, ">") == 0){
-                             close(1);
-                             if(open(fname, O_WRONLY|O_CREATE|O_TRUNC) < 0){ fprintf(2, "cannot open %s\n", fname); exit(1); }
-                         } else if(strcmp(redir, ">>") == 0){
-                             close(1);
-                             if(open(fname, O_WRONLY|O_CREATE|O_APPEND) < 0){ fprintf(2, "cannot open %s\n", fname); exit(1); }
-                         }
-                         c_args[j] = 0; 
-                    }
-                }
+            int pid = -1;
+            if(ok && c_args[0] != 0)
+                pid = spawnvp(c_args[0], c_args, acts, nacts);
+            for(int j=0; j<nredir; j++) close(redir_fds[j]);
 
-                // >>> Use new execvp logic here <<<
-                execvp(c_args[0], c_args);
-                
-                // execvp handles exit(1) on failure, so we shouldn't reach here.
-                exit(1);
-
-            } else {
-                // === PARENT PROCESS ===
-                if(prev_pipe_read != -1) close(prev_pipe_read);
-                if(i < num_cmds - 1){
-                    close(curr_pipe[1]); 
-                    prev_pipe_read = curr_pipe[0]; 
-                }
-                last_pid = pid; 
+            if(prev_pipe_read != -1) close(prev_pipe_read);
+            prev_pipe_read = -1;
+            if(i < num_cmds - 1){
+                close(curr_pipe[1]); 
+                prev_pipe_read = curr_pipe[0]; 
             }
+            if(pid >= 0) last_pid = pid;
+            else last_status = 1;
         }
         
         if (!is_background) {
@@ -0,0 +1,40 @@
+// Time null system calls: getpid(), which takes the
+// trampoline's fast path, and pause(0), which does just as
+// little but goes the whole way through usertrap(). Prints
+// time counter ticks per 1000 calls; compare kernels by
+// running it on each.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define N 10000
+
+static void
+report(char *what, uint64 t0)
+{
+  printf("%s: %lu ticks/1000 calls\n", what, (rdtime() - t0) * 1000 / N);
+}
+
+int
+main(int argc, char *argv[])
+{
+  uint64 t0;
+  int i;
+
+  t0 = rdtime();
+  for(i = 0; i < N; i++)
+    getpid();
+  report("getpid", t0);
+
+  t0 = rdtime();
+  for(i = 0; i < N; i++)
+    uptime();
+  report("uptime", t0);
+
+  t0 = rdtime();
+  for(i = 0; i < N; i++)
+    pause(0);
+  report("pause(0)", t0);
+  exit(0);
+}
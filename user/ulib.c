@@ -158,3 +158,10 @@ sbrklazy(int n) {
   return sys_sbrk(n, SBRK_LAZY);
 }
 
+// the time counter, for timing short things.
+uint64
+rdtime(void)
+{
+  return r_time();
+}
+
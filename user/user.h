@@ -1,6 +1,10 @@
 #define SBRK_ERROR ((char *)-1)
+#define MAP_FAILED ((void *)-1)
 
 struct stat;
+struct vmstat;
+struct spawnact;
+struct kstat;
 
 // system calls
 int fork(void);
@@ -25,6 +29,14 @@ char* sys_sbrk(int,int);
 int pause(int);
 int uptime(void);
 int getcwd(char*, int);
+int faultaround(int, struct vmstat*);
+void* mmap(void*, uint64, int, int, int, uint64);
+int munmap(void*, uint64);
+int spawn(const char*, char**, struct spawnact*, int);
+int kstat(struct kstat*);
+int setpriority(int, int);
+int nsleep(uint64);
+int copymode(int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -40,6 +52,7 @@ int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
 char* sbrk(int);
 char* sbrklazy(int);
+uint64 rdtime(void);
 
 // printf.c
 void fprintf(int, const char*, ...) __attribute__ ((format (printf, 2, 3)));
@@ -7,6 +7,9 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/vm.h"
+#include "kernel/spawn.h"
+#include "kernel/kstat.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -2139,6 +2142,45 @@ kernmem(char *s)
   }
 }
 
+// the kernel's device registers, which may be mapped in
+// the process's own page table, must be out of reach too.
+void
+devmem(char *s)
+{
+  uint64 addrs[] = { UART0, VIRTIO0, PLIC };
+  int i, pid, xstatus;
+
+  for(i = 0; i < sizeof(addrs)/sizeof(addrs[0]); i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      printf("%s: oops could read %p = %x\n", s, (void*)addrs[i],
+             *(volatile char*)addrs[i]);
+      exit(1);
+    }
+    wait(&xstatus);
+    if(xstatus != -1)
+      exit(1);
+
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      *(volatile char*)addrs[i] = 'x';
+      printf("%s: oops wrote %p\n", s, (void*)addrs[i]);
+      exit(1);
+    }
+    wait(&xstatus);
+    if(xstatus != -1)
+      exit(1);
+  }
+}
+
 // user code should not be able to write to addresses above MAXVA.
 void
 MAXVAplus(char *s)
@@ -2698,6 +2740,861 @@ lazy_copy(char *s)
   exit(0);
 }
 
+// fork shares memory copy-on-write; check that writes by
+// the parent, by the child, and by the kernel on either's
+// behalf (read() into a shared page) stay private.
+void
+cowfork(char *s)
+{
+  int n = 256;  // pages
+  char *a = sbrk(n*PGSIZE);
+  int fds[2];
+  int pid, i, xstatus;
+
+  if(a == SBRK_ERROR){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < n; i++)
+    a[i*PGSIZE] = i;
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[1]);
+    for(i = 0; i < n; i++){
+      if(a[i*PGSIZE] != (char)i){
+        printf("%s: child sees wrong value\n", s);
+        exit(1);
+      }
+    }
+    for(i = 0; i < n; i += 2)
+      a[i*PGSIZE] = 'c';
+    // copyout() into a page still shared with the parent.
+    if(read(fds[0], a + PGSIZE + 100, 1) != 1){
+      printf("%s: child read failed\n", s);
+      exit(1);
+    }
+    if(a[PGSIZE + 100] != 'x' || a[PGSIZE] != 1){
+      printf("%s: child read wrong value\n", s);
+      exit(1);
+    }
+    exit(0);
+  }
+
+  close(fds[0]);
+  for(i = 1; i < n; i += 4)
+    a[i*PGSIZE + 1] = 'p';
+  if(write(fds[1], "x", 1) != 1){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  close(fds[1]);
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+
+  for(i = 0; i < n; i++){
+    if(a[i*PGSIZE] != (char)i || a[PGSIZE + 100] != 0){
+      printf("%s: child's writes leaked into parent\n", s);
+      exit(1);
+    }
+  }
+
+  // fork again while most pages are still copy-on-write.
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(i = 0; i < n; i++)
+      if(a[i*PGSIZE] != (char)i)
+        exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: second child sees wrong value\n", s);
+    exit(1);
+  }
+  sbrk(-n*PGSIZE);
+}
+
+// reading lazily-allocated memory maps the shared zero
+// page, so a process can read far more untouched memory
+// than the machine has.
+void
+zeropage(char *s)
+{
+  int n = 256*1024*1024;
+  char *a, *p;
+  int pid, xstatus;
+
+  a = sbrklazy(n);
+  if(a == SBRK_ERROR){
+    printf("%s: sbrklazy failed\n", s);
+    exit(1);
+  }
+  for(p = a; p < a + n; p += PGSIZE){
+    if(*(volatile char *)p != 0){
+      printf("%s: lazy page not zero\n", s);
+      exit(1);
+    }
+  }
+
+  // writes replace the zero page, in this process only.
+  a[0] = 'x';
+  a[n/2 + 1] = 'y';
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    a[PGSIZE] = 'c';
+    exit(a[0] == 'x' && a[2*PGSIZE] == 0 ? 0 : 1);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child saw wrong values\n", s);
+    exit(1);
+  }
+  if(a[0] != 'x' || a[n/2 + 1] != 'y' || a[1] != 0 || a[PGSIZE] != 0){
+    printf("%s: wrong values after writes\n", s);
+    exit(1);
+  }
+  sbrk(-n);
+}
+
+// with a fault-around window, one fault on lazily-allocated
+// memory maps its neighbours too.
+void
+faultwin(char *s)
+{
+  int n = 64;  // pages
+  struct vmstat st;
+  uint64 nspec;
+  char *a;
+  int i;
+
+  if(faultaround(MAXFAULTAROUND+1, 0) != -1){
+    printf("%s: faultaround accepted a huge window\n", s);
+    exit(1);
+  }
+  faultaround(16, 0);
+  a = sbrklazy(n*PGSIZE);
+  for(i = 0; i < n; i++)
+    a[i*PGSIZE] = i;
+  if(faultaround(-1, &st) != 16 || st.faultwin != 16){
+    printf("%s: window not set\n", s);
+    exit(1);
+  }
+  if(st.nspec == 0 || st.nspecused != st.nspec){
+    printf("%s: %ld pages mapped ahead, %ld used\n", s, st.nspec, st.nspecused);
+    exit(1);
+  }
+
+  // no window: every page takes its own fault.
+  nspec = st.nspec;
+  faultaround(0, 0);
+  a = sbrklazy(n*PGSIZE);
+  for(i = 0; i < n; i++)
+    a[i*PGSIZE] = i;
+  faultaround(-1, &st);
+  if(st.nspec != nspec){
+    printf("%s: pages mapped ahead with no window\n", s);
+    exit(1);
+  }
+}
+
+// eager sbrk of 2MB-aligned stretches may use megapages;
+// check that fork and shrinking into the middle of one,
+// which split it, keep the memory intact.
+void
+megapage(char *s)
+{
+  uint64 mega = 512*PGSIZE;
+  char *a, *p;
+  uint64 top;
+  int pid, xstatus;
+
+  // align the break so that sbrk covers whole megapages.
+  top = (uint64)sbrk(0);
+  if(sbrk(((top + mega - 1) & ~(mega - 1)) - top) == SBRK_ERROR){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  a = sbrk(3*mega);
+  if(a == SBRK_ERROR){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(p = a; p < a + 3*mega; p += PGSIZE)
+    *(uint64*)p = (uint64)p;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(p = a; p < a + 3*mega; p += PGSIZE){
+      if(*(uint64*)p != (uint64)p)
+        exit(1);
+      *(uint64*)p = 0;
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child saw wrong values\n", s);
+    exit(1);
+  }
+
+  // end the break halfway through the second megapage.
+  if(sbrk(-(int)(mega + mega/2)) == SBRK_ERROR){
+    printf("%s: sbrk shrink failed\n", s);
+    exit(1);
+  }
+  for(p = a; p < a + mega + mega/2; p += PGSIZE){
+    if(*(uint64*)p != (uint64)p){
+      printf("%s: wrong value at %p\n", s, p);
+      exit(1);
+    }
+  }
+  sbrk(-(int)(mega + mega/2));
+}
+
+// mmap() of files, private and shared, and of anonymous memory.
+void
+mmaptest(char *s)
+{
+  int n = 2*PGSIZE + PGSIZE/2;  // file size
+  char buf[64];
+  char *a, *b;
+  int fd, i, m, pid, xstatus;
+
+  unlink("mmapf");
+  fd = open("mmapf", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < n; i += sizeof(buf)){
+    memset(buf, 'a' + (i / PGSIZE), sizeof(buf));
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  // a write-only file can't be read through any map.
+  fd = open("mmapf", O_WRONLY);
+  if(mmap(0, n, PROT_WRITE, MAP_SHARED, fd, 0) != MAP_FAILED){
+    printf("%s: map of write-only file\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  // a read-only file can't be written through a shared map.
+  fd = open("mmapf", O_RDONLY);
+  if(mmap(0, n, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0) != MAP_FAILED){
+    printf("%s: writable shared map of read-only file\n", s);
+    exit(1);
+  }
+
+  // private: the file, then zeros, and writes stay private.
+  a = mmap(0, n, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(a == MAP_FAILED){
+    printf("%s: mmap private failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  for(i = 0; i < 3*PGSIZE; i++){
+    if(a[i] != (i < n ? 'a' + i / PGSIZE : 0)){
+      printf("%s: wrong byte %d in private map\n", s, i);
+      exit(1);
+    }
+  }
+  a[0] = 'X';
+  if(munmap(a, 3*PGSIZE) < 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+
+  // shared: dirty pages go back to the file, including
+  // ones written by the kernel, and by a child.
+  fd = open("mmapf", O_RDWR);
+  a = mmap(0, n, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(a == MAP_FAILED){
+    printf("%s: mmap shared failed\n", s);
+    exit(1);
+  }
+  if(a[0] != 'a'){
+    printf("%s: private write reached the file\n", s);
+    exit(1);
+  }
+  a[1] = 'Y';
+  pid = fork();
+  if(pid == 0){
+    a[2] = 'Z';
+    exit(0);
+  }
+  wait(&xstatus);
+  if(a[2] != 'Z'){
+    printf("%s: child's write to shared map not seen\n", s);
+    exit(1);
+  }
+  // a page that is already there.
+  if(a[PGSIZE] != 'b' || read(fd, a + PGSIZE, 4) != 4 || a[PGSIZE] != 'a'){
+    printf("%s: read into shared map failed\n", s);
+    exit(1);
+  }
+  // unmap the middle page, then the rest.
+  if(munmap(a + PGSIZE, PGSIZE) < 0 || a[2*PGSIZE] != 'c'){
+    printf("%s: partial munmap failed\n", s);
+    exit(1);
+  }
+  a[2*PGSIZE] = 'W';
+  munmap(a, 3*PGSIZE);
+  close(fd);
+
+  fd = open("mmapf", O_RDONLY);
+  if(read(fd, buf, 3) != 3 || buf[0] != 'a' || buf[1] != 'Y' || buf[2] != 'Z'){
+    printf("%s: shared writes not in file\n", s);
+    exit(1);
+  }
+  for(i = 3; i < 2*PGSIZE; i += m){
+    m = 2*PGSIZE - i < sizeof(buf) ? 2*PGSIZE - i : sizeof(buf);
+    if(read(fd, buf, m) != m){
+      printf("%s: short file\n", s);
+      exit(1);
+    }
+  }
+  if(read(fd, buf, 1) != 1 || buf[0] != 'W'){
+    printf("%s: write after partial munmap not in file\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("mmapf");
+
+  // anonymous: private is copied on fork, shared is not.
+  a = mmap(0, 4*PGSIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, -1, 0);
+  b = mmap(0, 4*PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANON, -1, 0);
+  if(a == MAP_FAILED || b == MAP_FAILED){
+    printf("%s: mmap anon failed\n", s);
+    exit(1);
+  }
+  a[PGSIZE] = 1;
+  pid = fork();
+  if(pid == 0){
+    if(a[PGSIZE] != 1)
+      exit(1);
+    a[PGSIZE] = 2;
+    b[3*PGSIZE] = 3;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0 || a[PGSIZE] != 1 || b[3*PGSIZE] != 3){
+    printf("%s: anonymous maps wrong after fork\n", s);
+    exit(1);
+  }
+  munmap(a, 4*PGSIZE);
+  munmap(b, 4*PGSIZE);
+}
+
+// exec leaves the program's pages in its file until they are
+// used, so the kernel must read them in when it copies to or
+// from them, including while reading from a pipe.
+static char dpdata[3*PGSIZE] = { 'd' };  // in .data, not .bss
+
+void
+demandexec(char *s)
+{
+  int fds[2];
+  char c;
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if(write(fds[1], "hi", 2) != 2){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  if(read(fds[0], dpdata + 2*PGSIZE, 2) != 2 || dpdata[2*PGSIZE] != 'h'){
+    printf("%s: read into untouched data page failed\n", s);
+    exit(1);
+  }
+  if(write(fds[1], dpdata + PGSIZE, 1) != 1 || read(fds[0], &c, 1) != 1 || c != 0){
+    printf("%s: write from untouched data page failed\n", s);
+    exit(1);
+  }
+  if(dpdata[0] != 'd' || dpdata[2*PGSIZE + 1] != 'i'){
+    printf("%s: wrong data\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  // pages are read from the program file as they're used,
+  // so it can't be changed while init is running it.
+  if(open("init", O_RDWR) >= 0 || open("init", O_WRONLY|O_TRUNC) >= 0){
+    printf("%s: opened running program for writing\n", s);
+    exit(1);
+  }
+}
+
+// copy program from into file to.
+static void
+pccopy(char *s, char *from, char *to)
+{
+  char buf[512];
+  int fd1, fd2, n;
+
+  fd1 = open(from, O_RDONLY);
+  fd2 = open(to, O_CREATE|O_WRONLY|O_TRUNC);
+  if(fd1 < 0 || fd2 < 0){
+    printf("%s: open %s or %s failed\n", s, from, to);
+    exit(1);
+  }
+  while((n = read(fd1, buf, sizeof(buf))) > 0){
+    if(write(fd2, buf, n) != n){
+      printf("%s: write %s failed\n", s, to);
+      exit(1);
+    }
+  }
+  close(fd1);
+  close(fd2);
+}
+
+// run argv with its output in file pcout, and check the output.
+static void
+pcrun(char *s, char **argv, char *want)
+{
+  char buf[32];
+  int fd, n, xst;
+
+  if(fork() == 0){
+    close(1);
+    if(open("pcout", O_CREATE|O_WRONLY|O_TRUNC) != 1)
+      exit(1);
+    exec(argv[0], argv);
+    exit(1);
+  }
+  wait(&xst);
+  fd = open("pcout", O_RDONLY);
+  n = fd < 0 ? -1 : read(fd, buf, sizeof(buf)-1);
+  close(fd);
+  if(xst != 0 || n != strlen(want) || (buf[n] = 0, strcmp(buf, want) != 0)){
+    printf("%s: %s printed the wrong thing\n", s, argv[0]);
+    exit(1);
+  }
+}
+
+// processes running the same program share its text pages;
+// those must be forgotten when the program file changes.
+void
+sharedtext(char *s)
+{
+  char *echoargv[] = { "pcprog", "hello", 0 };
+  char *catargv[] = { "pcprog", "pcin", 0 };
+  int fd, i, pid, xst;
+
+  pccopy(s, "echo", "pcprog");
+  for(i = 0; i < 4; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      close(1);  // no output
+      exec("pcprog", echoargv);
+      exit(1);
+    }
+  }
+  for(i = 0; i < 4; i++){
+    wait(&xst);
+    if(xst != 0){
+      printf("%s: concurrent exec failed\n", s);
+      exit(1);
+    }
+  }
+  pcrun(s, echoargv, "hello\n");
+
+  fd = open("pcin", O_CREATE|O_WRONLY|O_TRUNC);
+  if(fd < 0 || write(fd, "meow", 4) != 4){
+    printf("%s: write pcin failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  pccopy(s, "cat", "pcprog");
+  pcrun(s, catargv, "meow");
+
+  unlink("pcprog");
+  unlink("pcin");
+  unlink("pcout");
+}
+
+// spawn() starts a program with redirected descriptors,
+// and fails cleanly on bad programs and bad actions.
+void
+spawntest(char *s)
+{
+  char *argv[] = { "echo", "spawned", 0 };
+  struct spawnact act[2];
+  char buf[16];
+  int fd, n, pid, xst;
+
+  fd = open("spawnout", O_CREATE|O_WRONLY|O_TRUNC);
+  if(fd < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  act[0].op = SPAWN_DUP2;
+  act[0].fd = fd;
+  act[0].newfd = 1;
+  act[1].op = SPAWN_CLOSE;
+  act[1].fd = fd;
+  pid = spawn("echo", argv, act, 2);
+  close(fd);
+  if(pid < 0){
+    printf("%s: spawn failed\n", s);
+    exit(1);
+  }
+  if(wait(&xst) != pid || xst != 0){
+    printf("%s: wait for spawned child failed\n", s);
+    exit(1);
+  }
+  fd = open("spawnout", O_RDONLY);
+  n = read(fd, buf, sizeof(buf));
+  close(fd);
+  unlink("spawnout");
+  if(n != 8 || memcmp(buf, "spawned\n", 8) != 0){
+    printf("%s: spawned child printed the wrong thing\n", s);
+    exit(1);
+  }
+
+  if(spawn("nosuchprogram", argv, 0, 0) >= 0){
+    printf("%s: spawn of missing program succeeded\n", s);
+    exit(1);
+  }
+  act[0].op = SPAWN_CLOSE;
+  act[0].fd = NOFILE - 1;
+  if(spawn("echo", argv, act, 1) >= 0){
+    printf("%s: spawn with bad fd action succeeded\n", s);
+    exit(1);
+  }
+  if(wait(0) != -1){
+    printf("%s: failed spawn left a child\n", s);
+    exit(1);
+  }
+}
+
+// TLB entries are no longer flushed on every trap, so check
+// that unmapped memory can't be used through a stale one,
+// and that forked processes don't see each other's pages.
+void
+staletlb(char *s)
+{
+  static int val;
+  char *p;
+  int i, pid, xst;
+
+  pid = fork();
+  if(pid == 0){
+    p = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, -1, 0);
+    if(p == MAP_FAILED)
+      exit(1);
+    p[0] = 1;
+    munmap(p, PGSIZE);
+    p[0] = 2;  // should be killed here
+    exit(0);
+  }
+  wait(&xst);
+  if(xst != -1){
+    printf("%s: write to unmapped page succeeded\n", s);
+    exit(1);
+  }
+
+  for(i = 0; i < 4; i++){
+    if(fork() == 0){
+      for(int j = 0; j < 10; j++){
+        val = i;
+        pause(1);
+        if(val != i)
+          exit(1);
+      }
+      exit(0);
+    }
+  }
+  for(i = 0; i < 4; i++){
+    wait(&xst);
+    if(xst != 0){
+      printf("%s: a child saw another's memory\n", s);
+      exit(1);
+    }
+  }
+}
+
+// getpid() and uptime() take a shorter way through the
+// kernel. check that they still give the right answers,
+// and that a process that does nothing else can be killed.
+void
+fastsyscall(char *s)
+{
+  int i, pid, xst;
+  uint t0, t;
+
+  t0 = uptime();
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    int me = getpid();
+    for(;;){
+      if(getpid() != me)
+        exit(1);
+    }
+  }
+  for(i = 0; i < 1000; i++){
+    t = uptime();
+    if(t < t0){
+      printf("%s: uptime went backwards\n", s);
+      exit(1);
+    }
+    t0 = t;
+  }
+  pause(2);
+  if(uptime() < t0 + 2){
+    printf("%s: uptime didn't advance\n", s);
+    exit(1);
+  }
+  kill(pid);
+  if(wait(&xst) != pid || xst != -1){
+    printf("%s: child wasn't killed (%d)\n", s, xst);
+    exit(1);
+  }
+}
+
+// pages with the same contents in two processes should be
+// merged by idle harts, and come apart again when written.
+void
+ksmtest(char *s)
+{
+  struct kstat st0, st;
+  int i, j, k, xst, npg = 8;
+
+  kstat(&st0);
+  for(k = 0; k < 2; k++){
+    int pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      uint64 *a = (uint64*)sbrk(npg * PGSIZE);
+      if(a == (uint64*)SBRK_ERROR)
+        exit(1);
+      for(i = 0; i < npg * PGSIZE/8; i++)
+        a[i] = i * 0x9e3779b97f4a7c15ULL;
+      // wait for the scan to merge our pages with the
+      // other child's, or most of them; two may collide
+      // in the kernel's tables.
+      for(j = 0; j < 300; j++){
+        kstat(&st);
+        if(st.ksmmerged - st0.ksmmerged >= npg/2)
+          break;
+        pause(1);
+      }
+      if(j == 300)
+        exit(2);
+      for(i = 0; i < npg * PGSIZE/8; i++)
+        if(a[i] != i * 0x9e3779b97f4a7c15ULL)
+          exit(3);
+      for(i = 0; i < npg * PGSIZE/8; i++)
+        a[i] = i + k;
+      pause(2);
+      for(i = 0; i < npg * PGSIZE/8; i++)
+        if(a[i] != i + k)
+          exit(4);
+      exit(0);
+    }
+  }
+  for(k = 0; k < 2; k++){
+    wait(&xst);
+    if(xst == 2){
+      printf("%s: pages weren't merged\n", s);
+      exit(1);
+    } else if(xst != 0){
+      printf("%s: merged pages have the wrong contents (%d)\n", s, xst);
+      exit(1);
+    }
+  }
+}
+
+// several readers and writers on one pipe, which wakes
+// them one at a time. none should be left asleep.
+void
+pipemany(char *s)
+{
+  int fds[2], cnt[2], i, k, n, total, xst;
+  char buf[300];
+
+  if(pipe(fds) < 0 || pipe(cnt) < 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  for(k = 0; k < 8; k++){
+    int pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      close(cnt[0]);
+      if(k < 4){
+        // a writer, in odd sizes.
+        close(fds[0]);
+        memset(buf, 'a' + k, sizeof(buf));
+        for(i = 0; i < 40; i++)
+          if(write(fds[1], buf, 1 + (i * 37 + k) % sizeof(buf)) < 0)
+            exit(1);
+        exit(0);
+      }
+      // a reader, counting what it gets.
+      close(fds[1]);
+      total = 0;
+      while((n = read(fds[0], buf, 1 + k * 13)) > 0)
+        total += n;
+      write(cnt[1], &total, sizeof(total));
+      exit(0);
+    }
+  }
+  close(fds[0]);
+  close(fds[1]);
+  close(cnt[1]);
+  for(k = 0; k < 8; k++){
+    wait(&xst);
+    if(xst != 0){
+      printf("%s: a child failed\n", s);
+      exit(1);
+    }
+  }
+  total = 0;
+  for(k = 0; k < 4; k++){
+    if(read(cnt[0], &n, sizeof(n)) != sizeof(n)){
+      printf("%s: a reader didn't report\n", s);
+      exit(1);
+    }
+    total += n;
+  }
+  close(cnt[0]);
+  n = 0;
+  for(k = 0; k < 4; k++)
+    for(i = 0; i < 40; i++)
+      n += 1 + (i * 37 + k) % sizeof(buf);
+  if(total != n){
+    printf("%s: read %d bytes, wrote %d\n", s, total, n);
+    exit(1);
+  }
+}
+
+// setpriority() returns the old nice value, rejects bad
+// ones, and fork() passes the value on.
+void
+nicetest(char *s)
+{
+  int pid, xst;
+
+  if(setpriority(0, 1) != 0 || setpriority(0, NPRIO-1) != 1){
+    printf("%s: setpriority didn't return the old value\n", s);
+    exit(1);
+  }
+  if(setpriority(0, -1) >= 0 || setpriority(0, NPRIO) >= 0 || setpriority(-5, 0) >= 0){
+    printf("%s: setpriority accepted a bad argument\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0)
+    exit(setpriority(0, 0) == NPRIO-1 ? 0 : 1);
+  wait(&xst);
+  if(xst != 0){
+    printf("%s: child's nice value not inherited\n", s);
+    exit(1);
+  }
+  setpriority(0, 0);
+}
+
+// nsleep() sleeps at least as long as asked, but not
+// until the next clock tick, and kill() interrupts it.
+void
+nsleeptest(char *s)
+{
+  uint64 t0, t, best;
+  int i, pid, xst;
+
+  best = ~0UL;
+  for(i = 0; i < 5; i++){
+    t0 = rdtime();
+    if(nsleep(2000000) < 0){
+      printf("%s: nsleep failed\n", s);
+      exit(1);
+    }
+    t = rdtime() - t0;
+    if(t < 2000000 / (1000000000 / TIMEFREQ)){
+      printf("%s: nsleep(2ms) returned after %lu\n", s, t);
+      exit(1);
+    }
+    if(t < best)
+      best = t;
+  }
+  if(best >= TIMEFREQ / TICKHZ){
+    printf("%s: nsleep(2ms) took a whole tick, %lu\n", s, best);
+    exit(1);
+  }
+
+  t0 = rdtime();
+  pause(1);
+  if(rdtime() - t0 < TIMEFREQ / TICKHZ){
+    printf("%s: pause(1) returned early\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    nsleep(~0UL);
+    exit(0);
+  }
+  pause(1);
+  kill(pid);
+  wait(&xst);
+  if(xst != -1){
+    printf("%s: kill didn't end nsleep\n", s);
+    exit(1);
+  }
+}
+
 struct test {
   void (*f)(char *);
   char *s;
@@ -2748,6 +3645,7 @@ struct test {
   {sbrkbasic, "sbrkbasic"},
   {sbrkmuch, "sbrkmuch"},
   {kernmem, "kernmem"},
+  {devmem, "devmem"},
   {MAXVAplus, "MAXVAplus"},
   {sbrkfail, "sbrkfail"},
   {sbrkarg, "sbrkarg"},
@@ -2765,6 +3663,20 @@ struct test {
   {lazy_alloc, "lazy_alloc"},
   {lazy_unmap, "lazy_unmap"},
   {lazy_copy, "lazy_copy"},
+  {cowfork, "cowfork"},
+  {zeropage, "zeropage"},
+  {faultwin, "faultwin"},
+  {megapage, "megapage"},
+  {mmaptest, "mmap"},
+  {demandexec, "demandexec"},
+  {sharedtext, "sharedtext"},
+  {spawntest, "spawn"},
+  {staletlb, "staletlb"},
+  {fastsyscall, "fastsyscall"},
+  {ksmtest, "ksm"},
+  {pipemany, "pipemany"},
+  {nicetest, "nice"},
+  {nsleeptest, "nsleep"},
   { 0, 0},
 };
 
@@ -3053,6 +3965,105 @@ outofinodes(char *s)
   }
 }
 
+// use more memory than the machine has, which must go to
+// swap, and check that every page comes back intact.
+void
+swapping(char *s)
+{
+  struct kstat st0, st;
+  int n = PHYSTOP - KERNBASE + 8*1024*1024;
+  char *a;
+  int i;
+
+  kstat(&st0);
+  a = sbrklazy(n);
+  if(a == SBRK_ERROR){
+    printf("%s: sbrklazy failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < n; i += PGSIZE)
+    *(int*)(a + i) = i ^ 0x5a5a;
+  for(i = 0; i < n; i += PGSIZE){
+    if(*(int*)(a + i) != (i ^ 0x5a5a)){
+      printf("%s: page at %p lost its contents\n", s, a + i);
+      exit(1);
+    }
+  }
+  kstat(&st);
+  if(st.swapout == st0.swapout || st.swapin == st0.swapin){
+    printf("%s: no swapping (%lu out, %lu in)\n", s,
+           st.swapout - st0.swapout, st.swapin - st0.swapin);
+    exit(1);
+  }
+  sbrk(-n);
+}
+
+// fill the page at p, or check that it's still full, with
+// repetitive text if it's one of every four pages of the
+// region, and with noise otherwise. Returns -1 if the
+// check fails.
+static int
+zramfill(char *p, int off, int check)
+{
+  uint64 *w = (uint64*)p;
+  uint64 v, x = off + 1;
+  int j;
+
+  for(j = 0; j < PGSIZE/8; j++){
+    if(off % (4*PGSIZE) == 0){
+      v = 0x20786f6620656874ULL + j % 7;  // "the fox "
+    } else {
+      x ^= x << 13;
+      x ^= x >> 7;
+      x ^= x << 17;
+      v = x;
+    }
+    if(!check)
+      w[j] = v;
+    else if(w[j] != v)
+      return -1;
+  }
+  return 0;
+}
+
+// with more memory in use than there is, pages that
+// compress well should be kept in zram, and the rest
+// should go to disk.
+void
+zramswap(char *s)
+{
+  struct kstat st0, st;
+  int n = PHYSTOP - KERNBASE + 32*1024*1024;
+  char *a;
+  int i;
+
+  kstat(&st0);
+  a = sbrklazy(n);
+  if(a == SBRK_ERROR){
+    printf("%s: sbrklazy failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < n; i += PGSIZE)
+    zramfill(a + i, i, 0);
+  for(i = 0; i < n; i += PGSIZE){
+    if(zramfill(a + i, i, 1) < 0){
+      printf("%s: page at %p lost its contents\n", s, a + i);
+      exit(1);
+    }
+  }
+  kstat(&st);
+  if(st.zramout == st0.zramout || st.zramin == st0.zramin){
+    printf("%s: nothing in zram (%lu out, %lu in)\n", s,
+           st.zramout - st0.zramout, st.zramin - st0.zramin);
+    exit(1);
+  }
+  if(st.swapout - st.zramout == st0.swapout - st0.zramout){
+    printf("%s: nothing swapped to disk\n", s);
+    exit(1);
+  }
+  sbrk(-n);
+}
+
 struct test slowtests[] = {
   {bigdir, "bigdir"},
   {manywrites, "manywrites"},
@@ -3060,6 +4071,8 @@ struct test slowtests[] = {
   {execout, "execout"},
   {diskfull, "diskfull"},
   {outofinodes, "outofinodes"},
+  {swapping, "swapping"},
+  {zramswap, "zramswap"},
     
   { 0, 0},
 };
@@ -43,3 +43,11 @@ entry("sbrk");
 entry("pause");
 entry("uptime");
 entry("getcwd");
+entry("faultaround");
+entry("mmap");
+entry("munmap");
+entry("spawn");
+entry("kstat");
+entry("setpriority");
+entry("nsleep");
+entry("copymode");
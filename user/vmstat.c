@@ -0,0 +1,67 @@
+// Print the kernel's counters.
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/kstat.h"
+#include "user/user.h"
+
+// print a/b to one decimal place, after s.
+static void
+tenths(char *s, uint64 a, uint64 b)
+{
+  uint64 r;
+
+  if(b == 0){
+    printf("%s-", s);
+    return;
+  }
+  r = a * 10 / b;
+  printf("%s%lu.%lu", s, r / 10, r % 10);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct kstat st;
+  int i;
+
+  if(kstat(&st) < 0){
+    fprintf(2, "vmstat: kstat failed\n");
+    exit(1);
+  }
+  printf("returns to user       %lu\n", st.uret);
+  // without ASIDs, trampoline.S flushed twice on the
+  // way into the kernel and twice on the way out.
+  printf("whole-TLB flushes     %lu (%lu without ASIDs)\n", st.tlbflush, 4*st.uret);
+  printf("address-space flushes %lu\n", st.tlbflushasid);
+  printf("page flushes          %lu\n", st.tlbflushpage);
+  printf("ASIDs                 %d, generation %lu\n", st.nasid, st.asidgen);
+  printf("swap                  %d of %d pages used\n", st.swapused, st.swapsize);
+  printf("pages swapped out     %lu\n", st.swapout);
+  printf("pages swapped in      %lu\n", st.swapin);
+  printf("zram                  %d pages in %d pages of memory\n", st.zramused, st.zrampool);
+  printf("  compressed          %lu bytes, ", st.zrambytes);
+  tenths("ratio ", (uint64)st.zramused * 4096, st.zrambytes);
+  tenths(", with pool overhead ", st.zramused, st.zrampool);
+  printf("\n");
+  printf("  out, in             %lu, %lu\n", st.zramout, st.zramin);
+  // r_time() counts at 10MHz under qemu.
+  printf("swap-in fault latency ");
+  tenths("disk ", st.swaptime - st.zramtime, (st.swapin - st.zramin) * 10);
+  tenths(" us, zram ", st.zramtime, st.zramin * 10);
+  printf(" us\n");
+  printf("same-page merging     %lu pages scanned, %lu merged\n", st.ksmscan, st.ksmmerged);
+  printf("  shared frames       %d, saving %d pages\n", st.ksmshared, st.ksmsaved);
+  printf("run queue steals      %lu\n", st.runqsteal);
+  printf("wakeups               %lu, ", st.wakeup);
+  tenths("sleepers looked at per wakeup ", st.wakescan, st.wakeup);
+  printf("\n");
+  for(i = 0; i < NPRIO; i++){
+    printf("run queue level %d     %d queued, %lu picked, ", i, st.runqlen[i], st.runqpick[i]);
+    tenths("average wait ", st.runqwait[i], st.runqpick[i] * 10000);
+    printf(" ms\n");
+  }
+  printf("clock interrupts      %lu, waking %lu sleepers\n", st.clockintr, st.timerwake);
+  printf("idle harts kicked     %lu\n", st.ipi);
+  exit(0);
+}
@@ -0,0 +1,88 @@
+// Time wakeups with many processes asleep: start nsleep
+// processes that each wait on a pipe of their own, then
+// time a pair of processes passing a byte back and forth
+// through pipes, which wakes one of them at every step.
+// Prints time counter ticks per 1000 round trips, and how
+// many sleeping processes each wakeup looked at.
+//
+// usage: wakebench [nsleep]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/kstat.h"
+#include "user/user.h"
+
+#define N 5000      // round trips
+#define MAXSLEEP 58
+
+int
+main(int argc, char *argv[])
+{
+  int nsleep = MAXSLEEP;
+  int sleeper[MAXSLEEP], ping[2], pong[2], fds[2];
+  int i, pid;
+  struct kstat st0, st;
+  uint64 t0, t, n;
+  char c;
+
+  if(argc > 1)
+    nsleep = atoi(argv[1]);
+  if(nsleep < 0 || nsleep > MAXSLEEP){
+    fprintf(2, "usage: wakebench [nsleep], at most %d\n", MAXSLEEP);
+    exit(1);
+  }
+
+  for(i = 0; i < nsleep; i++){
+    if((sleeper[i] = fork()) < 0){
+      fprintf(2, "wakebench: fork failed\n");
+      exit(1);
+    }
+    if(sleeper[i] == 0){
+      // nothing will ever be written.
+      if(pipe(fds) < 0)
+        exit(1);
+      read(fds[0], &c, 1);
+      exit(0);
+    }
+  }
+  pause(2);
+
+  if(pipe(ping) < 0 || pipe(pong) < 0){
+    fprintf(2, "wakebench: pipe failed\n");
+    exit(1);
+  }
+  kstat(&st0);
+  t0 = rdtime();
+  if((pid = fork()) < 0){
+    fprintf(2, "wakebench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    for(i = 0; i < N; i++){
+      if(read(ping[0], &c, 1) != 1 || write(pong[1], "x", 1) != 1)
+        exit(1);
+    }
+    exit(0);
+  }
+  for(i = 0; i < N; i++){
+    if(write(ping[1], "x", 1) != 1 || read(pong[0], &c, 1) != 1){
+      fprintf(2, "wakebench: ping-pong failed\n");
+      exit(1);
+    }
+  }
+  wait(0);
+  t = rdtime() - t0;
+  kstat(&st);
+
+  for(i = 0; i < nsleep; i++){
+    kill(sleeper[i]);
+    wait(0);
+  }
+
+  n = st.wakeup - st0.wakeup;
+  printf("%d asleep: %lu ticks/1000 round trips, %lu wakeups, %lu.%lu looked at per wakeup\n",
+         nsleep, t * 1000 / N, n, n ? (st.wakescan - st0.wakescan) / n : 0,
+         n ? (st.wakescan - st0.wakescan) * 10 / n % 10 : 0);
+  exit(0);
+}